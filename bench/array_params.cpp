@@ -0,0 +1,113 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  array_params.cpp
+//  UVPGPool
+//
+//  Benchmark: a 'WHERE id = ANY($1)' parameter as a binary array (UVPGParams::add(vector))
+//  against the text literal ("{1,2,3}") it replaces.  Doesn't need a database.
+//
+//	c++ -std=c++11 -O2 -I../uvpgpool -I`pg_config --includedir` -o array_params
+//		array_params.cpp ../uvpgpool/UVPGParams.cpp ../uvpgpool/UVPGByteSwap.cpp
+//
+
+#include "UVPGParams.h"
+#include "UVPGByteSwap.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+static volatile size_t sink;
+
+template<class F>
+static double nsPerElement(size_t elements, F run)
+{
+	// repeat for about the same amount of work whatever the array size.
+	size_t rounds = 20000000 / elements + 1;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(size_t ix = 0; ix < rounds; ++ix)
+		sink += run();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / (double)(rounds * elements);
+}
+
+template<class T>
+static size_t textLiteral(const std::vector<T> &values, std::string &out, const char *fmt)
+{
+	char buf[32];
+	out.assign("{");
+	for(size_t ix = 0; ix < values.size(); ++ix)
+	{
+		if(ix)
+			out.push_back(',');
+		out.append(buf, snprintf(buf, sizeof(buf), fmt, values[ix]));
+	}
+	out.push_back('}');
+	UVPGParams params(1);
+	params.add(out.c_str());
+	return params.lengths()[0];
+}
+
+template<class T>
+static size_t binaryArray(const std::vector<T> &values)
+{
+	UVPGParams params(1);
+	params.add(values);
+	return params.lengths()[0];
+}
+
+template<class T>
+static void compare(const char *type, size_t elements, const char *fmt)
+{
+	std::vector<T> values(elements);
+	for(size_t ix = 0; ix < elements; ++ix)
+		values[ix] = (T)(rand() % 100000000);
+	std::string text;
+	double text_ns = nsPerElement(elements, [&]() { return textLiteral(values, text, fmt); });
+	double binary_ns = nsPerElement(elements, [&]() { return binaryArray(values); });
+	printf("%-8s %8zu %12.2f %12.2f %8.1fx\n", type, elements, text_ns, binary_ns, text_ns / binary_ns);
+}
+
+int main(int argc, const char * argv[])
+{
+	printf("byte swap kernel: %s\n", uvpg_encode_kernel());
+	printf("%-8s %8s %12s %12s %9s\n", "type", "elements", "text ns/el", "binary ns/el", "speedup");
+	size_t sizes[] = { 16, 256, 4096, 65536 };
+	for(size_t ix = 0; ix < sizeof(sizes) / sizeof(sizes[0]); ++ix)
+	{
+		compare<int32_t>("int4[]", sizes[ix], "%" PRId32);
+		compare<int64_t>("int8[]", sizes[ix], "%" PRId64);
+		compare<double>("float8[]", sizes[ix], "%.17g");
+	}
+	return 0;
+}
@@ -0,0 +1,911 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  fake_pgserver.cpp
+//  UVPGPool
+//
+//  A stand-in for a postgres server, for load testing the pool without one.  Speaks enough
+//  of the v3 protocol for libpq: startup with trust auth (SSL and GSS requests are turned
+//  down), simple queries, Parse/Bind/Describe/Execute/Close/Sync (so pipelining and prepared
+//  statements work), COPY in both directions, errors, and cancel requests (which turn the
+//  query's answer into an error, if it's still being held back).  Every query returns the same made up rows; what it's asked doesn't matter,
+//  other than the first word (SELECT, COPY, BEGIN...) and "fake_error", which fails.
+//
+//	fake_pgserver [--port=5433] [--latency-ms=0] [--jitter-ms=0] [--rows=1] [--width=0]
+//		[--refuse=0] [--error=0] [--drop=0] [--max-clients=0]
+//
+//  latency is per query, jitter adds up to that much more at random.  rows and width are
+//  the size of each result: an int4 column "n", plus a text column "data" of 'width' bytes.
+//  refuse, error and drop are fractions (0 to 1) of connections turned away, of queries
+//  failed, and of queries where the server just closes the connection instead of answering.
+//  max-clients turns away connections beyond that many.
+//
+//	c++ -std=c++11 -O2 -o fake_pgserver fake_pgserver.cpp
+//
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define PROTOCOL_V3 196608
+#define SSL_REQUEST 80877103
+#define GSS_REQUEST 80877104
+#define CANCEL_REQUEST 80877102
+
+#define OID_INT4 23
+#define OID_TEXT 25
+
+static struct
+{
+	int port;
+	double latency_ms;
+	double jitter_ms;
+	int rows;
+	int width;
+	double refuse;
+	double error;
+	double drop;
+	int max_clients;
+} config = { 5433, 0, 0, 1, 0, 0, 0, 0, 0 };
+
+static struct
+{
+	uint64_t connections;
+	uint64_t refused;
+	uint64_t queries;
+	uint64_t errors;
+	uint64_t dropped;
+	uint64_t cancels;
+} stats;
+
+static volatile sig_atomic_t stopping = 0;
+
+static uint64_t nowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool chance(double fraction)
+{
+	return fraction > 0 && drand48() < fraction;
+}
+
+// outgoing messages are built into 'building', and handed to the socket in segments, each
+// held back until its query's latency has passed.
+class Segment
+{
+public:
+	uint64_t release; // nowNs() it can go out at.
+	std::string data;
+	bool close; // drop the connection here instead.
+};
+
+class Portal
+{
+public:
+	std::string query;
+	std::vector<int16_t> formats; // result column formats, as Bind gave them.
+};
+
+class Client
+{
+public:
+	Client(int in_fd) : fd(in_fd), started(false), closing(false), skip_to_sync(false), copy_in(false), copy_rows(0), txn('I'), pid(0), last_release(0) { };
+	int fd;
+	bool started;
+	bool closing; // once everything's sent.
+	bool skip_to_sync; // an extended query failed, ignore everything up to Sync.
+	bool copy_in;
+	uint64_t copy_rows;
+	char txn; // 'I'dle, in a 'T'ransaction, or 'E'rror.
+	int32_t pid;
+	std::string in;
+	std::string building;
+	std::deque<Segment> out;
+	uint64_t last_release;
+	std::map<std::string, std::string> statements;
+	std::map<std::string, Portal> portals;
+
+	// message building.
+	size_t begin(char type)
+	{
+		building.push_back(type);
+		size_t at = building.size();
+		building.append(4, '\0');
+		return at;
+	}
+	void end(size_t at)
+	{
+		uint32_t len = htonl((uint32_t)(building.size() - at));
+		memcpy(&building[at], &len, 4);
+	}
+	void putInt32(int32_t value) { uint32_t net = htonl((uint32_t)value); building.append((const char *)&net, 4); }
+	void putInt16(int16_t value) { uint16_t net = htons((uint16_t)value); building.append((const char *)&net, 2); }
+	void putString(const char *value) { building.append(value, strlen(value) + 1); }
+
+	// hands what's been built over to the socket.  'delayed' segments are answers to a query,
+	// held back by the configured latency (in order, never overtaking an earlier one).
+	void flush(bool delayed, bool close_after = false)
+	{
+		if(building.empty() && !close_after)
+			return;
+		uint64_t release = nowNs();
+		if(delayed)
+		{
+			double ms = config.latency_ms + (config.jitter_ms > 0 ? drand48() * config.jitter_ms : 0);
+			release += (uint64_t)(ms * 1000000.0);
+		}
+		if(release < last_release)
+			release = last_release;
+		last_release = release;
+		Segment segment;
+		segment.release = release;
+		segment.data.swap(building);
+		segment.close = close_after;
+		out.push_back(segment);
+	}
+};
+
+static int32_t next_pid = 1000;
+static size_t client_count = 0;
+
+//
+// responses
+//
+
+static void sendError(Client *client, const char *severity, const char *code, const char *message)
+{
+	size_t at = client->begin('E');
+	client->building.push_back('S');
+	client->putString(severity);
+	client->building.push_back('V');
+	client->putString(severity);
+	client->building.push_back('C');
+	client->putString(code);
+	client->building.push_back('M');
+	client->putString(message);
+	client->building.push_back('\0');
+	client->end(at);
+	stats.errors++;
+}
+
+static void sendReady(Client *client)
+{
+	size_t at = client->begin('Z');
+	client->building.push_back(client->txn);
+	client->end(at);
+}
+
+static void sendParameter(Client *client, const char *name, const char *value)
+{
+	size_t at = client->begin('S');
+	client->putString(name);
+	client->putString(value);
+	client->end(at);
+}
+
+static void sendRowDescription(Client *client, const std::vector<int16_t> &formats)
+{
+	int columns = config.width > 0 ? 2 : 1;
+	size_t at = client->begin('T');
+	client->putInt16((int16_t)columns);
+	for(int col = 0; col < columns; ++col)
+	{
+		// a single format code applies to every column, none means text.
+		int16_t format = formats.empty() ? 0 : formats[formats.size() == 1 ? 0 : (col < (int)formats.size() ? col : 0)];
+		client->putString(col == 0 ? "n" : "data");
+		client->putInt32(0); // table
+		client->putInt16(0); // column
+		client->putInt32(col == 0 ? OID_INT4 : OID_TEXT);
+		client->putInt16(col == 0 ? 4 : -1);
+		client->putInt32(-1); // typmod
+		client->putInt16(format);
+	}
+	client->end(at);
+}
+
+static void sendRows(Client *client, const std::vector<int16_t> &formats)
+{
+	bool binary = !formats.empty() && formats[0] == 1;
+	std::string data(config.width > 0 ? config.width : 0, 'x');
+	for(int row = 1; row <= config.rows; ++row)
+	{
+		size_t at = client->begin('D');
+		client->putInt16(config.width > 0 ? 2 : 1);
+		if(binary)
+		{
+			client->putInt32(4);
+			client->putInt32(row);
+		}
+		else
+		{
+			char text[16];
+			int len = snprintf(text, sizeof(text), "%d", row);
+			client->putInt32(len);
+			client->building.append(text, len);
+		}
+		if(config.width > 0)
+		{
+			client->putInt32((int32_t)data.size());
+			client->building.append(data);
+		}
+		client->end(at);
+	}
+}
+
+static void sendComplete(Client *client, const char *tag)
+{
+	size_t at = client->begin('C');
+	client->putString(tag);
+	client->end(at);
+}
+
+// the first word of a statement, upper cased.
+static std::string command(const std::string &query)
+{
+	size_t start = query.find_first_not_of(" \t\r\n(");
+	if(start == std::string::npos)
+		return std::string();
+	std::string word;
+	for(size_t ix = start; ix < query.size() && isalpha((unsigned char)query[ix]); ++ix)
+		word.push_back((char)toupper((unsigned char)query[ix]));
+	return word;
+}
+
+static bool returnsRows(const std::string &cmd)
+{
+	return cmd == "SELECT" || cmd == "WITH" || cmd == "VALUES" || cmd == "SHOW" || cmd == "TABLE" || cmd == "FETCH";
+}
+
+static bool copyFromStdin(const std::string &query)
+{
+	std::string upper;
+	for(size_t ix = 0; ix < query.size(); ++ix)
+		upper.push_back((char)toupper((unsigned char)query[ix]));
+	return upper.find("FROM STDIN") != std::string::npos;
+}
+
+// runs a statement (not the parse/describe part).  Returns false if it failed.
+static bool execute(Client *client, const std::string &query, const std::vector<int16_t> &formats, bool describe)
+{
+	stats.queries++;
+	std::string cmd = command(query);
+	if(client->txn == 'E' && cmd != "ROLLBACK" && cmd != "ABORT" && cmd != "COMMIT" && cmd != "END")
+	{
+		sendError(client, "ERROR", "25P02", "current transaction is aborted, commands ignored until end of transaction block");
+		return false;
+	}
+	if(query.find("fake_error") != std::string::npos || chance(config.error))
+	{
+		sendError(client, "ERROR", "XX000", "fake_pgserver: made up failure");
+		if(client->txn == 'T')
+			client->txn = 'E';
+		return false;
+	}
+
+	char tag[64];
+	if(cmd == "COPY")
+	{
+		size_t at = client->begin(copyFromStdin(query) ? 'G' : 'H');
+		client->building.push_back(0); // text
+		client->putInt16(0);
+		client->end(at);
+		if(copyFromStdin(query))
+		{
+			client->copy_in = true;
+			client->copy_rows = 0;
+			return true;
+		}
+		std::string line(config.width > 0 ? config.width : 8, 'x');
+		line.push_back('\n');
+		for(int row = 0; row < config.rows; ++row)
+		{
+			at = client->begin('d');
+			client->building.append(line);
+			client->end(at);
+		}
+		at = client->begin('c');
+		client->end(at);
+		snprintf(tag, sizeof(tag), "COPY %d", config.rows);
+		sendComplete(client, tag);
+		return true;
+	}
+	if(returnsRows(cmd))
+	{
+		if(describe)
+			sendRowDescription(client, formats);
+		sendRows(client, formats);
+		snprintf(tag, sizeof(tag), "SELECT %d", config.rows);
+		sendComplete(client, tag);
+		return true;
+	}
+
+	if(cmd == "BEGIN" || cmd == "START")
+		client->txn = 'T';
+	else if(cmd == "COMMIT" || cmd == "END" || cmd == "ROLLBACK" || cmd == "ABORT")
+		client->txn = 'I';
+	if(cmd == "INSERT")
+		snprintf(tag, sizeof(tag), "INSERT 0 1");
+	else if(cmd == "UPDATE" || cmd == "DELETE")
+		snprintf(tag, sizeof(tag), "%s 1", cmd.c_str());
+	else if(cmd == "START")
+		snprintf(tag, sizeof(tag), "START TRANSACTION");
+	else
+		snprintf(tag, sizeof(tag), "%s", cmd.empty() ? "SET" : cmd.c_str());
+	sendComplete(client, tag);
+	return true;
+}
+
+//
+// incoming messages
+//
+
+// reads a NUL terminated string out of a message body.
+static std::string getString(const char *&at, const char *end)
+{
+	const char *stop = (const char *)memchr(at, '\0', end - at);
+	if(stop == NULL)
+		stop = end;
+	std::string value(at, stop - at);
+	at = stop < end ? stop + 1 : end;
+	return value;
+}
+
+static int32_t getInt32(const char *&at, const char *end)
+{
+	uint32_t net = 0;
+	if(end - at >= 4)
+		memcpy(&net, at, 4);
+	at += 4;
+	return (int32_t)ntohl(net);
+}
+
+static int16_t getInt16(const char *&at, const char *end)
+{
+	uint16_t net = 0;
+	if(end - at >= 2)
+		memcpy(&net, at, 2);
+	at += 2;
+	return (int16_t)ntohs(net);
+}
+
+static std::vector<Client *> clients;
+
+// the oldest answer still being held back turns into a "canceled" error, right away.
+static void cancel(int32_t pid)
+{
+	for(size_t ix = 0; ix < clients.size(); ++ix)
+	{
+		Client *client = clients[ix];
+		if(client == NULL || client->pid != pid)
+			continue;
+		uint64_t now = nowNs();
+		for(size_t sx = 0; sx < client->out.size(); ++sx)
+		{
+			Segment &segment = client->out[sx];
+			if(segment.release <= now || segment.close)
+				continue;
+			std::string saved;
+			saved.swap(client->building);
+			sendError(client, "ERROR", "57014", "canceling statement due to user request");
+			sendReady(client);
+			segment.data.swap(client->building);
+			client->building.swap(saved);
+			segment.release = now;
+			return;
+		}
+	}
+}
+
+// the first message, which has no type byte.  Returns false to drop the connection.
+static bool startup(Client *client, const char *body, const char *end)
+{
+	int32_t code = getInt32(body, end);
+	if(code == SSL_REQUEST || code == GSS_REQUEST)
+	{
+		client->building.push_back('N');
+		client->flush(false);
+		return true;
+	}
+	if(code == CANCEL_REQUEST)
+	{
+		stats.cancels++;
+		cancel(getInt32(body, end));
+		return false;
+	}
+	if(code != PROTOCOL_V3)
+		return false;
+
+	stats.connections++;
+	if(chance(config.refuse) || (config.max_clients > 0 && client_count > (size_t)config.max_clients))
+	{
+		stats.refused++;
+		sendError(client, "FATAL", "53300", "sorry, too many clients already");
+		client->flush(false, true);
+		return true;
+	}
+	client->started = true;
+	client->pid = next_pid++;
+	size_t at = client->begin('R');
+	client->putInt32(0); // AuthenticationOk
+	client->end(at);
+	sendParameter(client, "server_version", "16.0");
+	sendParameter(client, "server_encoding", "UTF8");
+	sendParameter(client, "client_encoding", "UTF8");
+	sendParameter(client, "DateStyle", "ISO, MDY");
+	sendParameter(client, "integer_datetimes", "on");
+	sendParameter(client, "standard_conforming_strings", "on");
+	sendParameter(client, "TimeZone", "UTC");
+	at = client->begin('K');
+	client->putInt32(client->pid);
+	client->putInt32(rand());
+	client->end(at);
+	sendReady(client);
+	client->flush(false);
+	return true;
+}
+
+static void simpleQuery(Client *client, const std::string &text)
+{
+	// one answer per statement.  Not a real parser, a ';' inside a string splits it too.
+	std::vector<int16_t> formats;
+	bool any = false;
+	size_t start = 0;
+	while(start <= text.size())
+	{
+		size_t stop = text.find(';', start);
+		if(stop == std::string::npos)
+			stop = text.size();
+		std::string statement = text.substr(start, stop - start);
+		start = stop + 1;
+		if(command(statement).empty())
+			continue;
+		any = true;
+		if(chance(config.drop))
+		{
+			stats.dropped++;
+			client->flush(true, true);
+			return;
+		}
+		if(!execute(client, statement, formats, true) || client->copy_in)
+			break;
+	}
+	if(!any)
+	{
+		size_t at = client->begin('I'); // EmptyQueryResponse
+		client->end(at);
+	}
+	if(!client->copy_in)
+		sendReady(client);
+	client->flush(true);
+}
+
+// one complete message.  Returns false to drop the connection.
+static bool message(Client *client, char type, const char *body, const char *end)
+{
+	if(client->copy_in)
+	{
+		switch(type)
+		{
+			case 'd':
+				for(const char *at = body; at < end; ++at)
+					if(*at == '\n')
+						client->copy_rows++;
+				return true;
+			case 'c':
+			{
+				char tag[64];
+				snprintf(tag, sizeof(tag), "COPY %llu", (unsigned long long)client->copy_rows);
+				client->copy_in = false;
+				sendComplete(client, tag);
+				break;
+			}
+			case 'f':
+				client->copy_in = false;
+				sendError(client, "ERROR", "57014", "COPY from stdin failed");
+				client->skip_to_sync = true;
+				break;
+			case 'S':
+			case 'H':
+				// libpq may send these without noticing the command was a COPY, but the
+				// CopyInResponse still has to go out.
+				client->flush(true);
+				return true;
+			default:
+				client->copy_in = false;
+				sendError(client, "ERROR", "08P01", "unexpected message during COPY");
+				break;
+		}
+		// a simple query's COPY ends with ReadyForQuery, an extended one's waits for Sync.
+		if(client->portals.empty())
+			sendReady(client);
+		client->flush(true);
+		return true;
+	}
+
+	if(type == 'X')
+		return false;
+	if(type == 'Q')
+	{
+		client->portals.clear();
+		simpleQuery(client, getString(body, end));
+		return true;
+	}
+	if(type == 'S')
+	{
+		client->skip_to_sync = false;
+		client->portals.clear();
+		sendReady(client);
+		client->flush(true);
+		return true;
+	}
+	if(client->skip_to_sync)
+		return true;
+
+	switch(type)
+	{
+		case 'P':
+		{
+			std::string name = getString(body, end);
+			client->statements[name] = getString(body, end);
+			size_t at = client->begin('1');
+			client->end(at);
+			break;
+		}
+		case 'B':
+		{
+			std::string portal = getString(body, end);
+			std::string name = getString(body, end);
+			std::map<std::string, std::string>::iterator found = client->statements.find(name);
+			if(found == client->statements.end())
+			{
+				sendError(client, "ERROR", "26000", "prepared statement does not exist");
+				client->skip_to_sync = true;
+				break;
+			}
+			int16_t count = getInt16(body, end);
+			body += count * 2;
+			count = getInt16(body, end);
+			for(int ix = 0; ix < count && body < end; ++ix)
+			{
+				int32_t len = getInt32(body, end);
+				if(len > 0)
+					body += len;
+			}
+			Portal &bound = client->portals[portal];
+			bound.query = found->second;
+			bound.formats.clear();
+			count = getInt16(body, end);
+			for(int ix = 0; ix < count && body < end; ++ix)
+				bound.formats.push_back(getInt16(body, end));
+			size_t at = client->begin('2');
+			client->end(at);
+			break;
+		}
+		case 'D':
+		{
+			char what = body < end ? *body++ : 'P';
+			std::string name = getString(body, end);
+			std::string query;
+			std::vector<int16_t> formats;
+			if(what == 'S')
+			{
+				std::map<std::string, std::string>::iterator found = client->statements.find(name);
+				if(found == client->statements.end())
+				{
+					sendError(client, "ERROR", "26000", "prepared statement does not exist");
+					client->skip_to_sync = true;
+					break;
+				}
+				query = found->second;
+				// every $n is said to be text, libpq sends them as whatever it was told.
+				int params = 0;
+				for(size_t ix = query.find('$'); ix != std::string::npos; ix = query.find('$', ix + 1))
+					params = std::max(params, atoi(query.c_str() + ix + 1));
+				size_t at = client->begin('t');
+				client->putInt16((int16_t)params);
+				for(int ix = 0; ix < params; ++ix)
+					client->putInt32(OID_TEXT);
+				client->end(at);
+			}
+			else
+			{
+				Portal &portal = client->portals[name];
+				query = portal.query;
+				formats = portal.formats;
+			}
+			if(returnsRows(command(query)))
+				sendRowDescription(client, formats);
+			else
+			{
+				size_t at = client->begin('n'); // NoData
+				client->end(at);
+			}
+			break;
+		}
+		case 'E':
+		{
+			std::string name = getString(body, end);
+			Portal &portal = client->portals[name];
+			if(command(portal.query).empty())
+			{
+				size_t at = client->begin('I');
+				client->end(at);
+				break;
+			}
+			if(chance(config.drop))
+			{
+				stats.dropped++;
+				client->flush(true, true);
+				return true;
+			}
+			if(!execute(client, portal.query, portal.formats, false))
+				client->skip_to_sync = true;
+			break;
+		}
+		case 'C':
+		{
+			char what = body < end ? *body++ : 'S';
+			std::string name = getString(body, end);
+			if(what == 'S')
+				client->statements.erase(name);
+			else
+				client->portals.erase(name);
+			size_t at = client->begin('3');
+			client->end(at);
+			break;
+		}
+		case 'H':
+			client->flush(true);
+			break;
+		default:
+			sendError(client, "ERROR", "08P01", "fake_pgserver: unsupported message");
+			client->skip_to_sync = true;
+			break;
+	}
+	return true;
+}
+
+// everything complete in client->in.  Returns false to drop the connection.
+static bool consume(Client *client)
+{
+	size_t at = 0;
+	bool keep = true;
+	while(keep && !client->closing)
+	{
+		const char *data = client->in.data() + at;
+		size_t left = client->in.size() - at;
+		size_t header = client->started ? 5 : 4;
+		if(left < header)
+			break;
+		uint32_t len;
+		memcpy(&len, data + header - 4, 4);
+		len = ntohl(len);
+		if(len < 4 || len > (1 << 30))
+			return false;
+		if(left < header - 4 + len)
+			break;
+		const char *body = data + header;
+		const char *end = data + header - 4 + len;
+		if(client->started)
+			keep = message(client, data[0], body, end);
+		else
+			keep = startup(client, body, end);
+		at += header - 4 + len;
+		if(!client->out.empty() && client->out.back().close)
+			client->closing = true;
+	}
+	client->in.erase(0, at);
+	return keep;
+}
+
+//
+// sockets
+//
+
+static void onSignal(int sig)
+{
+	stopping = 1;
+}
+
+int main(int argc, char * const argv[])
+{
+	static struct option options[] = {
+		{ "port", required_argument, NULL, 'p' },
+		{ "latency-ms", required_argument, NULL, 'l' },
+		{ "jitter-ms", required_argument, NULL, 'j' },
+		{ "rows", required_argument, NULL, 'r' },
+		{ "width", required_argument, NULL, 'w' },
+		{ "refuse", required_argument, NULL, 'R' },
+		{ "error", required_argument, NULL, 'e' },
+		{ "drop", required_argument, NULL, 'd' },
+		{ "max-clients", required_argument, NULL, 'm' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+	{
+		switch(opt)
+		{
+			case 'p': config.port = atoi(optarg); break;
+			case 'l': config.latency_ms = atof(optarg); break;
+			case 'j': config.jitter_ms = atof(optarg); break;
+			case 'r': config.rows = atoi(optarg); break;
+			case 'w': config.width = atoi(optarg); break;
+			case 'R': config.refuse = atof(optarg); break;
+			case 'e': config.error = atof(optarg); break;
+			case 'd': config.drop = atof(optarg); break;
+			case 'm': config.max_clients = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [--port=5433] [--latency-ms=0] [--jitter-ms=0] [--rows=1] [--width=0] "
+						"[--refuse=0] [--error=0] [--drop=0] [--max-clients=0]\n", argv[0]);
+				return 1;
+		}
+	}
+	srand48((long)nowNs());
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)config.port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 1024) != 0)
+	{
+		fprintf(stderr, "fake_pgserver: can't listen on port %d: %s\n", config.port, strerror(errno));
+		return 1;
+	}
+	fcntl(listener, F_SETFL, O_NONBLOCK);
+	printf("fake_pgserver listening on 127.0.0.1:%d\n", config.port);
+	fflush(stdout);
+
+	std::vector<struct pollfd> fds;
+	char buf[65536];
+	while(!stopping)
+	{
+		// wait for sockets, or the next held back segment.
+		uint64_t now = nowNs();
+		int timeout = -1;
+		fds.clear();
+		struct pollfd listen_fd = { listener, POLLIN, 0 };
+		fds.push_back(listen_fd);
+		for(size_t ix = 0; ix < clients.size(); ++ix)
+		{
+			Client *client = clients[ix];
+			struct pollfd pfd = { client->fd, (short)(client->closing ? 0 : POLLIN), 0 };
+			if(!client->out.empty())
+			{
+				if(client->out.front().release <= now)
+					pfd.events |= POLLOUT;
+				else
+				{
+					int wait = (int)((client->out.front().release - now) / 1000000) + 1;
+					if(timeout < 0 || wait < timeout)
+						timeout = wait;
+				}
+			}
+			fds.push_back(pfd);
+		}
+		if(poll(&fds[0], fds.size(), timeout) < 0 && errno != EINTR)
+			break;
+
+		if(fds[0].revents & POLLIN)
+		{
+			int fd;
+			while((fd = accept(listener, NULL, NULL)) >= 0)
+			{
+				fcntl(fd, F_SETFL, O_NONBLOCK);
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+				clients.push_back(new Client(fd));
+				client_count++;
+			}
+		}
+
+		now = nowNs();
+		for(size_t ix = 1; ix < fds.size(); ++ix)
+		{
+			Client *client = clients[ix - 1];
+			bool keep = true;
+			if(fds[ix].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+				ssize_t got = read(client->fd, buf, sizeof(buf));
+				if(got > 0)
+				{
+					client->in.append(buf, got);
+					keep = consume(client);
+				}
+				else if(got == 0 || (errno != EAGAIN && errno != EINTR))
+					keep = false;
+			}
+			// whatever's due goes out, as much as the socket takes.
+			while(keep && !client->out.empty() && client->out.front().release <= now)
+			{
+				Segment &segment = client->out.front();
+				if(!segment.data.empty())
+				{
+					ssize_t sent = write(client->fd, segment.data.data(), segment.data.size());
+					if(sent < 0)
+					{
+						if(errno != EAGAIN && errno != EINTR)
+							keep = false;
+						break;
+					}
+					segment.data.erase(0, sent);
+					if(!segment.data.empty())
+						break;
+				}
+				if(segment.close)
+					keep = false;
+				client->out.pop_front();
+			}
+			if(!keep)
+			{
+				close(client->fd);
+				delete client;
+				clients[ix - 1] = NULL;
+				client_count--;
+			}
+		}
+		std::vector<Client *> open;
+		for(size_t ix = 0; ix < clients.size(); ++ix)
+			if(clients[ix])
+				open.push_back(clients[ix]);
+		clients.swap(open);
+	}
+
+	printf("fake_pgserver: %llu connections (%llu refused), %llu queries, %llu errors, %llu dropped, %llu cancels\n",
+		   (unsigned long long)stats.connections, (unsigned long long)stats.refused, (unsigned long long)stats.queries,
+		   (unsigned long long)stats.errors, (unsigned long long)stats.dropped, (unsigned long long)stats.cancels);
+	return 0;
+}
@@ -0,0 +1,311 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  pg_load.cpp
+//  UVPGPool
+//
+//  Load generator: drives sendQueryAndDo() at a steady rate for a while, then reports
+//  throughput and latency percentiles, along with the pool's own metrics.  Meant to be run
+//  against fake_pgserver, for a repeatable end to end test that doesn't need a database,
+//  but any server will do.
+//
+//	pg_load [--conninfo="host=127.0.0.1 port=5433 ..."] [--rate=1000] [--duration=10]
+//		[--min-connections=5] [--max-connections=50] [--pipeline=0] [--statements=0]
+//		[--timeout-ms=0] [--keys=1000] [--shared] [--batch=0] [--query="SELECT n FROM bench WHERE n = $1"]
+//
+//  Each query's parameter is one of 'keys' values.  --shared sends them with
+//  sharedQueryAndDo(), so identical queries already on their way are joined instead of sent.
+//  --batch=N looks them up through a UVPGBatch instead, up to N keys per query, with
+//  "SELECT n FROM bench WHERE n = ANY($1)" (or --query); rows that come back for the wrong key
+//  count as errors.
+//
+//  Latency is measured from when each query was due to be sent, not when it was, so a
+//  pool that falls behind shows up in the numbers instead of just slowing the sender down.
+//
+//	c++ -std=c++11 -O2 -I../uvpgpool -I`pg_config --includedir` -o pg_load pg_load.cpp
+//		../uvpgpool/UVPGPool.cpp ../uvpgpool/UVPGParams.cpp ../uvpgpool/UVPGByteSwap.cpp
+//		../uvpgpool/UVPGTimerWheel.cpp ../uvpgpool/UVPGCopy.cpp ../uvpgpool/UVPGMetrics.cpp
+//		../uvpgpool/UVPGBatch.cpp ../uvpgpool/UVPGResult.cpp
+//		-L`pg_config --libdir` -lpq -luv
+//
+
+#include "UVPGPool.h"
+#include "UVPGBatch.h"
+#include "UVPGResult.h"
+
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+static struct
+{
+	const char *conninfo;
+	const char *query;
+	double rate;
+	double duration;
+	unsigned min_connections;
+	unsigned max_connections;
+	unsigned pipeline;
+	unsigned statements;
+	unsigned timeout_ms;
+	unsigned keys;
+	bool shared;
+	unsigned batch;
+} config = { "host=127.0.0.1 port=5433 user=bench dbname=bench sslmode=disable gssencmode=disable",
+			 NULL, 1000, 10, 5, 50, 0, 0, 0, 1000, false, 0 };
+
+static UVPGPool *pool;
+static UVPGBatch *batch;
+static uv_timer_t send_timer;
+static uint64_t started_at; // uv_hrtime()
+static uint64_t sent;
+static uint64_t completed;
+static uint64_t failed;
+static uint64_t errors; // answered, but with an error.
+static UVPGHistogram latency;
+
+// what a query was due to be sent at, uv_hrtime().
+class load_query
+{
+public:
+	uint64_t due;
+	int32_t key;
+};
+
+static void finishQuery(load_query *query)
+{
+	latency.record((uv_hrtime() - query->due) / 1000);
+	delete query;
+}
+
+void load_result_cb(PGconn *conn, void *data)
+{
+	PGresult *result = PQgetResult(conn);
+	ExecStatusType status = PQresultStatus(result);
+	if(status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK)
+		completed++;
+	else
+		errors++;
+	PQclear(result);
+	pool->returnConnection(conn);
+	finishQuery((load_query *)data);
+}
+
+void load_shared_cb(UVPGSharedResult *result, void *data)
+{
+	if(result == NULL)
+		failed++;
+	else if(PQresultStatus(result->get()) == PGRES_TUPLES_OK || PQresultStatus(result->get()) == PGRES_COMMAND_OK)
+		completed++;
+	else
+		errors++;
+	finishQuery((load_query *)data);
+}
+
+void load_batch_cb(UVPGSharedResult *result, const int *rows, int count, void *data)
+{
+	load_query *query = (load_query *)data;
+	if(result == NULL)
+		failed++;
+	else if(PQresultStatus(result->get()) != PGRES_TUPLES_OK)
+		errors++;
+	else
+	{
+		UVPGResult reader(result->get());
+		int32_t n;
+		int ix;
+		for(ix = 0; ix < count; ++ix)
+		{
+			if(!reader.get(rows[ix], 0, n) || n != query->key)
+				break;
+		}
+		if(ix < count)
+			errors++;
+		else
+			completed++;
+	}
+	finishQuery(query);
+}
+
+void load_failure_cb(PGconn *conn, void *data)
+{
+	failed++;
+	if(conn)
+		pool->returnConnection(conn);
+	finishQuery((load_query *)data);
+}
+
+static void report()
+{
+	double elapsed = (uv_hrtime() - started_at) / 1e9;
+	uvpg_histogram_snapshot lat;
+	latency.snapshot(lat);
+	printf("\n%llu sent, %llu completed, %llu errors, %llu failed in %.2fs: %.1f queries/s\n",
+		   (unsigned long long)sent, (unsigned long long)completed, (unsigned long long)errors,
+		   (unsigned long long)failed, elapsed, completed / elapsed);
+	printf("latency (us): p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, max %llu, mean %.1f\n",
+		   (unsigned long long)lat.percentile(50), (unsigned long long)lat.percentile(90),
+		   (unsigned long long)lat.percentile(99), (unsigned long long)lat.percentile(99.9),
+		   (unsigned long long)lat.max, lat.mean());
+
+	uvpg_pool_snapshot metrics;
+	pool->getMetrics(metrics);
+	printf("pool (us): acquire wait p99 %llu, queued p99 %llu, first byte p50 %llu / p99 %llu\n",
+		   (unsigned long long)metrics.acquire_wait.percentile(99), (unsigned long long)metrics.queue_wait.percentile(99),
+		   (unsigned long long)metrics.first_byte.percentile(50), (unsigned long long)metrics.first_byte.percentile(99));
+	if(config.shared)
+		printf("pool: %llu of the queries shared another one's result\n", (unsigned long long)metrics.coalesced);
+	printf("pool: %u connecting, %u available, %u busy, %u validating, %u pipelined, %u waiting, %llu timeouts\n",
+		   metrics.states[ConnStatus::cs_connecting], metrics.states[ConnStatus::cs_available], metrics.states[ConnStatus::cs_busy],
+		   metrics.states[ConnStatus::cs_validating], metrics.states[ConnStatus::cs_pipelined], metrics.pending,
+		   (unsigned long long)metrics.timeouts);
+}
+
+void on_drain_timer(uv_timer_t *handle, int status)
+{
+	// stop once everything sent has been answered (or failed), or after a grace period.
+	uint64_t done = completed + errors + failed;
+	if(done < sent && uv_hrtime() - started_at < (uint64_t)((config.duration + 5) * 1e9))
+		return;
+	uv_timer_stop(handle);
+	report();
+	if(batch)
+		batch->close();
+	uv_stop(pool->getLoop());
+}
+
+void on_send_timer(uv_timer_t *handle, int status)
+{
+	// send whatever's come due since the last tick, each with the time it was due at.
+	uint64_t now = uv_hrtime();
+	uint64_t end = started_at + (uint64_t)(config.duration * 1e9);
+	uint64_t until = now < end ? now : end;
+	uint64_t due_count = (uint64_t)((until - started_at) / 1e9 * config.rate);
+	uvpg_query_opts opts;
+	opts.timeout_ms = config.timeout_ms;
+	while(sent < due_count)
+	{
+		load_query *query = new load_query;
+		query->due = started_at + (uint64_t)(sent / config.rate * 1e9);
+		query->key = (int32_t)(sent % config.keys);
+		sent++;
+		if(batch)
+		{
+			batch->lookup(query->key, query, load_batch_cb);
+			continue;
+		}
+		UVPGParams params(1);
+		params.add(query->key);
+		if(config.shared)
+			pool->sharedQueryAndDo(config.query, &params, FORMAT_BINARY, query, load_shared_cb, &opts);
+		else
+			pool->sendQueryAndDo(config.query, &params, FORMAT_BINARY, query, load_result_cb, load_failure_cb, &opts);
+	}
+	if(now >= end)
+	{
+		uv_timer_stop(handle);
+		uv_timer_start(handle, on_drain_timer, 10, 10);
+	}
+}
+
+void on_ready(UVPGPool *ready_pool, void *data)
+{
+	printf("%u connections up, sending %.0f queries/s for %.1fs\n", config.min_connections, config.rate, config.duration);
+	started_at = uv_hrtime();
+	uv_timer_start(&send_timer, on_send_timer, 1, 1);
+}
+
+int main(int argc, char * const argv[])
+{
+	static struct option options[] = {
+		{ "conninfo", required_argument, NULL, 'c' },
+		{ "query", required_argument, NULL, 'q' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "min-connections", required_argument, NULL, 'm' },
+		{ "max-connections", required_argument, NULL, 'M' },
+		{ "pipeline", required_argument, NULL, 'p' },
+		{ "statements", required_argument, NULL, 's' },
+		{ "timeout-ms", required_argument, NULL, 't' },
+		{ "keys", required_argument, NULL, 'k' },
+		{ "shared", no_argument, NULL, 'S' },
+		{ "batch", required_argument, NULL, 'b' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+	{
+		switch(opt)
+		{
+			case 'c': config.conninfo = optarg; break;
+			case 'q': config.query = optarg; break;
+			case 'r': config.rate = atof(optarg); break;
+			case 'd': config.duration = atof(optarg); break;
+			case 'm': config.min_connections = (unsigned)atoi(optarg); break;
+			case 'M': config.max_connections = (unsigned)atoi(optarg); break;
+			case 'p': config.pipeline = (unsigned)atoi(optarg); break;
+			case 's': config.statements = (unsigned)atoi(optarg); break;
+			case 't': config.timeout_ms = (unsigned)atoi(optarg); break;
+			case 'k': config.keys = (unsigned)atoi(optarg); break;
+			case 'S': config.shared = true; break;
+			case 'b': config.batch = (unsigned)atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [--conninfo=...] [--rate=1000] [--duration=10] [--min-connections=5] "
+						"[--max-connections=50] [--pipeline=0] [--statements=0] [--timeout-ms=0] [--keys=1000] [--shared] [--batch=0] [--query=...]\n", argv[0]);
+				return 1;
+		}
+	}
+	if(config.rate <= 0 || config.duration <= 0 || config.keys == 0)
+	{
+		fprintf(stderr, "pg_load: rate, duration and keys have to be more than 0\n");
+		return 1;
+	}
+	if(config.query == NULL)
+		config.query = config.batch ? "SELECT n FROM bench WHERE n = ANY($1)" : "SELECT n FROM bench WHERE n = $1";
+
+	uv_loop_t *loop = uv_default_loop();
+	pool = new UVPGPool(loop, config.conninfo, config.min_connections, 1, config.max_connections, config.max_connections);
+	if(config.pipeline)
+		pool->setPipelineDepth(config.pipeline);
+	if(config.statements)
+		pool->setStatementCacheSize(config.statements);
+	if(config.batch)
+	{
+		uvpg_query_opts opts;
+		opts.timeout_ms = config.timeout_ms;
+		batch = new UVPGBatch(pool, config.query, UVPGBatch::key_int32, 0, config.batch);
+		batch->setQueryOpts(opts);
+	}
+	uv_timer_init(loop, &send_timer);
+	pool->setReadyCallback(on_ready, NULL);
+
+	uv_run(loop, UV_RUN_DEFAULT);
+	return 0;
+}
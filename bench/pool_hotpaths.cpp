@@ -0,0 +1,365 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  pool_hotpaths.cpp
+//  UVPGPool
+//
+//  Benchmark: the pool's hot paths (taking and returning connections, handle lookups,
+//  queueing queries and dispatching them, building parameters) at 5 to 1000 connections
+//  and 1 to 32 threads.  Doesn't need a database: the pool's entries get PGconns which
+//  never connected (a unix socket that isn't there), so sends fail straight away, and
+//  returned entries are made available again directly instead of being validated.
+//  Prints one line per case, Google Benchmark style; an argument filters cases by name.
+//
+//	c++ -std=c++11 -O2 -pthread -I../uvpgpool -I`pg_config --includedir` -o pool_hotpaths
+//		pool_hotpaths.cpp ../uvpgpool/UVPGPool.cpp ../uvpgpool/UVPGParams.cpp
+//		../uvpgpool/UVPGByteSwap.cpp ../uvpgpool/UVPGTimerWheel.cpp ../uvpgpool/UVPGCopy.cpp
+//		../uvpgpool/UVPGMetrics.cpp -L`pg_config --libdir` -lpq -luv
+//
+
+#include "UVPGPool.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define BENCH_CONNINFO "host=/nonexistent/uvpgpool-bench"
+
+static volatile size_t sink;
+static const char *filter = NULL;
+
+// reaches into UVPGPool (it's a friend) to stand in for the database.
+class UVPGPoolBench
+{
+public:
+	// a pool of 'count' available entries on a loop of its own, which never runs.
+	static UVPGPool *create(unsigned count)
+	{
+		uv_loop_t *loop = (uv_loop_t *)malloc(sizeof(uv_loop_t));
+		uv_loop_init(loop);
+		// its first connection fails, which starts the reconnect backoff.  The loop never
+		// runs, so the backoff never ends, and the pool never tries to connect on its own.
+		// (the failure gets printed, which would only clutter the results.)
+		fflush(stdout);
+		int saved = dup(STDOUT_FILENO);
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, STDOUT_FILENO);
+		UVPGPool *pool = new UVPGPool(loop, BENCH_CONNINFO, 1, 0, count, count);
+		fflush(stdout);
+		dup2(saved, STDOUT_FILENO);
+		close(devnull);
+		close(saved);
+		uv_timer_stop(&pool->reconnect_timer);
+		uv_timer_stop(&pool->health_timer);
+		uv_timer_stop(&pool->reap_timer);
+		pool->reconnect_at.store(~0ULL);
+		for(unsigned ix = 0; ix < count; ++ix)
+		{
+			UVPGConnEntry *entry;
+			if(ix < pool->connections.size())
+				entry = pool->connections[ix];
+			else
+			{
+				entry = new UVPGConnEntry;
+				entry->pool = pool;
+				entry->index = (uint32_t)pool->connections.size();
+				pool->connections.push_back(entry);
+			}
+			entry->conn = PQconnectStart(BENCH_CONNINFO);
+			pool->attachConn(entry);
+			pool->open_count++;
+			entry->status.store(ConnStatus::cs_available);
+			pool->available_count++;
+			pool->free_entries.push(entry);
+		}
+		return pool;
+	}
+	static void destroy(UVPGPool *pool)
+	{
+		// the loop is left as it is; closing it would mean running it.
+		delete pool;
+	}
+	// what the loop does for a returned connection, minus talking to the server.
+	static size_t recycle(UVPGPool *pool)
+	{
+		size_t count = 0;
+		UVPGConnEntry *entry;
+		while((entry = pool->returned_entries.pop()) != NULL)
+		{
+			pool->makeAvailable(entry, ConnStatus::cs_validating);
+			count++;
+		}
+		return count;
+	}
+	static UVPGConnEntry *findEntry(UVPGPool *pool, uvpg_conn_handle handle) { return pool->findConnEntry(handle); }
+	static UVPGConnEntry *findEntry(UVPGPool *pool, PGconn *conn) { return pool->findConnEntry(conn); }
+};
+
+static bool wanted(const char *name)
+{
+	return filter == NULL || strstr(name, filter) != NULL;
+}
+
+static void report(const char *name, double ns, size_t ops)
+{
+	printf("%-44s %10.1f ns %12zu\n", name, ns / (double)ops, ops);
+	fflush(stdout);
+}
+
+// runs op(thread) 'ops' times on each of 'threads' threads, and reports the wall time per op.
+template<class F>
+static void runThreaded(const char *name, unsigned threads, size_t ops, F op)
+{
+	std::vector<std::thread> workers;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned tx = 0; tx < threads; ++tx)
+	{
+		workers.push_back(std::thread([&, tx]() {
+			size_t local = 0;
+			for(size_t ix = 0; ix < ops; ++ix)
+				local += op(tx);
+			sink += local;
+		}));
+	}
+	for(size_t tx = 0; tx < workers.size(); ++tx)
+		workers[tx].join();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	report(name, elapsed.count(), ops * threads);
+}
+
+static void benchAcquireReturn(unsigned pool_size, unsigned threads)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "BM_AcquireReturn/pool:%u/threads:%u", pool_size, threads);
+	if(!wanted(name))
+		return;
+	UVPGPool *pool = UVPGPoolBench::create(pool_size);
+	runThreaded(name, threads, 2000000 / threads, [pool](unsigned) -> size_t {
+		uvpg_conn_handle handle = pool->acquireConn(false);
+		if(handle != UVPG_INVALID_HANDLE)
+			pool->returnConnection(handle);
+		return UVPGPoolBench::recycle(pool);
+	});
+	UVPGPoolBench::destroy(pool);
+}
+
+static void benchGetFreeConn(unsigned pool_size, unsigned threads)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "BM_GetFreeConn/pool:%u/threads:%u", pool_size, threads);
+	if(!wanted(name))
+		return;
+	UVPGPool *pool = UVPGPoolBench::create(pool_size);
+	runThreaded(name, threads, 2000000 / threads, [pool](unsigned) -> size_t {
+		PGconn *conn = pool->getFreeConn(false);
+		if(conn)
+			pool->returnConnection(conn);
+		return UVPGPoolBench::recycle(pool);
+	});
+	UVPGPoolBench::destroy(pool);
+}
+
+static void benchFindConnEntry(unsigned pool_size, unsigned threads)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "BM_FindConnEntry/handle/pool:%u/threads:%u", pool_size, threads);
+	bool by_handle = wanted(name);
+	char conn_name[128];
+	snprintf(conn_name, sizeof(conn_name), "BM_FindConnEntry/pgconn/pool:%u/threads:%u", pool_size, threads);
+	bool by_conn = wanted(conn_name);
+	if(!by_handle && !by_conn)
+		return;
+
+	// everything checked out, so there's something to look up.
+	UVPGPool *pool = UVPGPoolBench::create(pool_size);
+	std::vector<uvpg_conn_handle> handles;
+	std::vector<PGconn *> conns;
+	for(unsigned ix = 0; ix < pool_size; ++ix)
+	{
+		handles.push_back(pool->acquireConn(false));
+		conns.push_back(pool->handleConn(handles.back()));
+	}
+	// a stride through them, so it isn't always the same cache line.
+	if(by_handle)
+		runThreaded(name, threads, 4000000 / threads, [&](unsigned tx) -> size_t {
+			static thread_local size_t at = 0;
+			at = (at + 7 + tx) % handles.size();
+			return (size_t)UVPGPoolBench::findEntry(pool, handles[at]);
+		});
+	if(by_conn)
+		runThreaded(conn_name, threads, 4000000 / threads, [&](unsigned tx) -> size_t {
+			static thread_local size_t at = 0;
+			at = (at + 7 + tx) % conns.size();
+			return (size_t)UVPGPoolBench::findEntry(pool, conns[at]);
+		});
+	UVPGPoolBench::destroy(pool);
+}
+
+static UVPGPool *dispatch_pool;
+static size_t dispatched;
+
+static void bench_failed(PGconn *conn, void *data)
+{
+	dispatched++;
+	dispatch_pool->returnConnection(conn);
+}
+
+static void bench_result(PGconn *conn, void *data)
+{
+	// sends never get anywhere, see bench_failed().
+}
+
+static void benchQueueDispatch(unsigned pool_size)
+{
+	// loop thread only, so no threads here.  Each round checks out every connection, queues
+	// pool_size queries behind them, then gives the connections back and lets
+	// checkQueuedRequests() hand the queries out.  The sends fail, and the failure callback
+	// returns the connection, so this is the pool's own overhead for a queued query.
+	char name[128];
+	snprintf(name, sizeof(name), "BM_QueueDispatch/pool:%u", pool_size);
+	if(!wanted(name))
+		return;
+	UVPGPool *pool = UVPGPoolBench::create(pool_size);
+	dispatch_pool = pool;
+	dispatched = 0;
+	std::vector<uvpg_conn_handle> handles(pool_size);
+	UVPGParams params(1);
+	params.add((int32_t)42);
+	size_t rounds = 1000000 / pool_size + 1;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(size_t round = 0; round < rounds; ++round)
+	{
+		for(unsigned ix = 0; ix < pool_size; ++ix)
+			handles[ix] = pool->acquireConn(false);
+		for(unsigned ix = 0; ix < pool_size; ++ix)
+			pool->sendQueryAndDo("SELECT userid FROM users WHERE userid = $1", &params, FORMAT_BINARY, NULL, bench_result, bench_failed);
+		for(unsigned ix = 0; ix < pool_size; ++ix)
+			pool->returnConnection(handles[ix]);
+		// each dispatch returns its connection, which has to be recycled before the next.
+		while(pool->pendingCount() > 0)
+		{
+			UVPGPoolBench::recycle(pool);
+			pool->checkQueuedRequests();
+		}
+		UVPGPoolBench::recycle(pool);
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	report(name, elapsed.count(), dispatched);
+	UVPGPoolBench::destroy(pool);
+}
+
+static void benchParams(size_t count)
+{
+	char name[128];
+	size_t rounds = 4000000 / count;
+
+	snprintf(name, sizeof(name), "BM_ParamsAdd/params:%zu", count);
+	if(wanted(name))
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(size_t round = 0; round < rounds; ++round)
+		{
+			UVPGParams params(count);
+			for(size_t ix = 0; ix < count; ++ix)
+			{
+				if(ix & 1)
+					params.add((int64_t)ix);
+				else
+					params.add("username");
+			}
+			sink += params.size();
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		report(name, elapsed.count(), rounds * count);
+	}
+
+	UVPGParams source(count);
+	for(size_t ix = 0; ix < count; ++ix)
+		source.add((int32_t)ix);
+
+	snprintf(name, sizeof(name), "BM_ParamsCopy/params:%zu", count);
+	if(wanted(name))
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(size_t round = 0; round < rounds; ++round)
+		{
+			UVPGParams params(source);
+			sink += params.size();
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		report(name, elapsed.count(), rounds);
+	}
+
+	snprintf(name, sizeof(name), "BM_ParamsReuse/params:%zu", count);
+	if(wanted(name))
+	{
+		// the way the pool's UVPGQuery free list uses them: clear() and add again.
+		UVPGParams params(count);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(size_t round = 0; round < rounds; ++round)
+		{
+			params.clear();
+			params.assign(source.arrays());
+			sink += params.size();
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		report(name, elapsed.count(), rounds);
+	}
+}
+
+int main(int argc, const char * argv[])
+{
+	if(argc > 1)
+		filter = argv[1];
+	printf("%-44s %13s %12s\n", "Benchmark", "Time", "Iterations");
+
+	unsigned sizes[] = { 5, 50, 1000 };
+	unsigned threads[] = { 1, 4, 32 };
+	for(size_t sx = 0; sx < sizeof(sizes) / sizeof(sizes[0]); ++sx)
+	{
+		for(size_t tx = 0; tx < sizeof(threads) / sizeof(threads[0]); ++tx)
+		{
+			benchAcquireReturn(sizes[sx], threads[tx]);
+			benchGetFreeConn(sizes[sx], threads[tx]);
+			benchFindConnEntry(sizes[sx], threads[tx]);
+		}
+		benchQueueDispatch(sizes[sx]);
+	}
+	size_t param_counts[] = { 1, 4, 16 };
+	for(size_t px = 0; px < sizeof(param_counts) / sizeof(param_counts[0]); ++px)
+		benchParams(param_counts[px]);
+	return 0;
+}
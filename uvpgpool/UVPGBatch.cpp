@@ -0,0 +1,213 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+//
+//  UVPGBatch.cpp
+//  UVPGPool
+//
+
+#include "UVPGBatch.h"
+#include "UVPGResult.h"
+
+#include <assert.h>
+
+// uvpg_result_cb's for a batch's query.
+static void uvpg_batch_result(PGconn *conn, void *data)
+{
+	uvpg_batch_flight *flight = (uvpg_batch_flight *)data;
+	PGresult *res = PQgetResult(conn);
+	flight->pool->returnConnection(conn);
+	flight->landed(res);
+	delete flight;
+}
+
+static void uvpg_batch_failed(PGconn *conn, void *data)
+{
+	uvpg_batch_flight *flight = (uvpg_batch_flight *)data;
+	if(conn != NULL)
+		flight->pool->returnConnection(conn);
+	flight->landed(NULL);
+	delete flight;
+}
+
+static void uvpg_batch_window(uv_timer_t *timer, int status)
+{
+	UVPGBatch *batch = (UVPGBatch *)timer->data;
+	batch->flush();
+}
+
+void uvpg_batch_closed(uv_handle_t *handle)
+{
+	delete (UVPGBatch *)handle->data;
+}
+
+//
+// uvpg_batch_flight
+//
+
+void uvpg_batch_flight::landed(PGresult *res)
+{
+	// sort the rows out by key, then hand everyone theirs.
+	UVPGSharedResult *shared = NULL;
+	std::vector<std::vector<int> > rows(keyCount());
+	if(res != NULL)
+	{
+		shared = new UVPGSharedResult(res);
+		UVPGResult reader(res);
+		if(PQresultStatus(res) == PGRES_TUPLES_OK && key_column >= 0 && key_column < reader.cols())
+		{
+			int64_t int_key;
+			uvpg_bytes text_key;
+			std::string text;
+			for(int row = 0; row < reader.rows(); ++row)
+			{
+				if(text_keys)
+				{
+					if(!reader.get(row, key_column, text_key) || text_key.data == NULL)
+						continue;
+					text.assign(text_key.data, text_key.length);
+					std::unordered_map<std::string, unsigned>::iterator found = text_index.find(text);
+					if(found != text_index.end())
+						rows[found->second].push_back(row);
+				}
+				else
+				{
+					if(!reader.get(row, key_column, int_key))
+						continue;
+					std::unordered_map<int64_t, unsigned>::iterator found = int_index.find(int_key);
+					if(found != int_index.end())
+						rows[found->second].push_back(row);
+				}
+			}
+		}
+	}
+	for(size_t ix = 0; ix < waiters.size(); ++ix)
+	{
+		std::vector<int> &matched = rows[waiters[ix].key];
+		waiters[ix].callback(shared, matched.empty() ? NULL : &matched[0], (int)matched.size(), waiters[ix].data);
+	}
+	if(shared != NULL)
+		shared->release();
+}
+
+//
+// UVPGBatch
+//
+
+UVPGBatch::UVPGBatch(UVPGPool *in_pool, const char *in_query, int in_key_type, int in_key_column,
+					 unsigned in_max_keys, unsigned in_window_ms, int in_result_format)
+: pool(in_pool), query(in_query), key_type(in_key_type), key_column(in_key_column),
+  max_keys(in_max_keys ? in_max_keys : 1), window_ms(in_window_ms), result_format(in_result_format),
+  collecting(NULL), params(1)
+{
+	uv_timer_init(pool->getLoop(), &timer);
+	timer.data = this;
+}
+
+uvpg_batch_flight *UVPGBatch::collect()
+{
+	if(collecting == NULL)
+	{
+		collecting = new uvpg_batch_flight;
+		collecting->pool = pool;
+		collecting->text_keys = key_type == key_text;
+		collecting->key_column = key_column;
+		uv_timer_start(&timer, uvpg_batch_window, window_ms, 0);
+	}
+	return collecting;
+}
+
+void UVPGBatch::lookup(int64_t key, void *data, uvpg_batch_cb callback)
+{
+	assert(key_type != key_text);
+	uvpg_batch_flight *flight = collect();
+	unsigned index = (unsigned)flight->ints.size();
+	std::pair<std::unordered_map<int64_t, unsigned>::iterator, bool> added = flight->int_index.insert(std::make_pair(key, index));
+	if(added.second)
+		flight->ints.push_back(key);
+	uvpg_batch_flight::waiter waiter = { added.first->second, callback, data };
+	flight->waiters.push_back(waiter);
+	if(flight->keyCount() >= max_keys)
+		flush();
+}
+
+void UVPGBatch::lookup(const char *key, void *data, uvpg_batch_cb callback)
+{
+	assert(key_type == key_text);
+	assert(key != NULL);
+	if(key == NULL)
+	{
+		callback(NULL, NULL, 0, data);
+		return;
+	}
+	uvpg_batch_flight *flight = collect();
+	unsigned index = (unsigned)flight->texts.size();
+	std::pair<std::unordered_map<std::string, unsigned>::iterator, bool> added = flight->text_index.insert(std::make_pair(std::string(key), index));
+	if(added.second)
+		flight->texts.push_back(key);
+	uvpg_batch_flight::waiter waiter = { added.first->second, callback, data };
+	flight->waiters.push_back(waiter);
+	if(flight->keyCount() >= max_keys)
+		flush();
+}
+
+void UVPGBatch::flush()
+{
+	uv_timer_stop(&timer);
+	uvpg_batch_flight *flight = collecting;
+	if(flight == NULL)
+		return;
+	collecting = NULL;
+	
+	// all the keys go out as one array parameter; the pool copies it if it has to wait.
+	params.clear();
+	switch(key_type)
+	{
+		case key_int32:
+			keys32.assign(flight->ints.begin(), flight->ints.end());
+			params.add(keys32);
+			break;
+		case key_int64:
+			params.add(flight->ints);
+			break;
+		case key_text:
+			key_strings.clear();
+			for(size_t ix = 0; ix < flight->texts.size(); ++ix)
+				key_strings.push_back(flight->texts[ix].c_str());
+			params.add(key_strings);
+			break;
+	}
+	pool->sendQueryAndDo(query.c_str(), &params, result_format, flight, uvpg_batch_result, uvpg_batch_failed, &opts);
+}
+
+void UVPGBatch::close()
+{
+	flush();
+	uv_close((uv_handle_t *)&timer, uvpg_batch_closed);
+}
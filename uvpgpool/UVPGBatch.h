@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+//
+//  UVPGBatch.h
+//  UVPGPool
+//
+
+#ifndef __UVPGBatch__
+#define __UVPGBatch__
+
+#include "UVPGPool.h"
+#include "UVPGParams.h"
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+// called once per lookup: the rows of 'res' whose key column matched, by row number (none,
+// if nothing did, or the query failed on the server; check PQresultStatus).  The result is
+// shared with the rest of the batch, see UVPGSharedResult.  res is NULL if the batch's query
+// couldn't be run at all.
+typedef void (*uvpg_batch_cb)(UVPGSharedResult *res, const int *rows, int count, void *data);
+
+// one batch's query on its way: its keys, and who asked for which.
+class uvpg_batch_flight
+{
+public:
+	UVPGPool *pool;
+	bool text_keys;
+	int key_column;
+	std::vector<int64_t> ints; // distinct keys, in the order they went out.
+	std::vector<std::string> texts;
+	std::unordered_map<int64_t, unsigned> int_index; // key -> index into ints/texts.
+	std::unordered_map<std::string, unsigned> text_index;
+	struct waiter
+	{
+		unsigned key;
+		uvpg_batch_cb callback;
+		void *data;
+	};
+	std::vector<waiter> waiters;
+	
+	unsigned keyCount() { return (unsigned)(text_keys ? texts.size() : ints.size()); }
+	void landed(PGresult *res);
+};
+
+// turns bursts of the same point lookup, with different keys, into one query.  The query
+// takes all the keys as an array, in $1 ("SELECT id, name FROM users WHERE id = ANY($1)"),
+// and returns the key in column 'key_column', which is how rows get back to whoever asked.
+// lookup() collects keys until there are 'max_keys' of them (the same key twice counts once),
+// or until 'window_ms' after the first, then sends them all, and each lookup's callback gets
+// its own rows out of the one result.  A window of 0 still batches everything looked up before
+// the loop gets around to timers.  key_int32 keys have to fit in an int32_t.  Loop thread only.
+// close() sends whatever's collected and gets rid of the batch; queries already sent finish on
+// their own.
+class UVPGBatch
+{
+private:
+	UVPGPool *pool;
+	std::string query;
+	int key_type;
+	int key_column;
+	unsigned max_keys;
+	unsigned window_ms;
+	int result_format;
+	uvpg_query_opts opts;
+	uv_timer_t timer;
+	uvpg_batch_flight *collecting; // NULL until something's looked up.
+	UVPGParams params;
+	std::vector<int32_t> keys32;
+	std::vector<const char *> key_strings;
+	
+	~UVPGBatch() { };
+	uvpg_batch_flight *collect();
+	friend void uvpg_batch_closed(uv_handle_t *handle);
+	
+public:
+	// what the keys are, and what $1 goes out as: int4[], int8[] or text[].
+	enum { key_int32, key_int64, key_text };
+	
+	UVPGBatch(UVPGPool *in_pool, const char *in_query, int in_key_type, int in_key_column,
+			  unsigned in_max_keys=100, unsigned in_window_ms=1, int in_result_format=FORMAT_BINARY);
+	void setQueryOpts(const uvpg_query_opts &in_opts) { opts = in_opts; }
+	
+	// key_int32 and key_int64 batches.
+	void lookup(int64_t key, void *data, uvpg_batch_cb callback);
+	// key_text batches.  A NULL key can't match anything, so it fails right away (res NULL).
+	void lookup(const char *key, void *data, uvpg_batch_cb callback);
+	void flush(); // send what's collected now, without waiting out the window.
+	void close();
+};
+
+#endif /* defined(__UVPGBatch__) */
@@ -0,0 +1,247 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  UVPGByteSwap.cpp
+//  UVPGPool
+//
+
+#include "UVPGByteSwap.h"
+#include "byteorder_endian.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define UVPG_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+typedef void (*uvpg_encode_fn)(char *out, const void *in, size_t count);
+
+static void uvpg_encode16_scalar(char *out, const void *in, size_t count)
+{
+	const char *src = (const char *)in;
+	uint32_t length = htobe32(2);
+	for(size_t ix = 0; ix < count; ++ix, src += 2, out += 6)
+	{
+		uint16_t value;
+		memcpy(&value, src, 2);
+		value = htobe16(value);
+		memcpy(out, &length, 4);
+		memcpy(out + 4, &value, 2);
+	}
+}
+
+static void uvpg_encode32_scalar(char *out, const void *in, size_t count)
+{
+	const char *src = (const char *)in;
+	uint32_t length = htobe32(4);
+	for(size_t ix = 0; ix < count; ++ix, src += 4, out += 8)
+	{
+		uint32_t value;
+		memcpy(&value, src, 4);
+		value = htobe32(value);
+		memcpy(out, &length, 4);
+		memcpy(out + 4, &value, 4);
+	}
+}
+
+static void uvpg_encode64_scalar(char *out, const void *in, size_t count)
+{
+	const char *src = (const char *)in;
+	uint32_t length = htobe32(8);
+	for(size_t ix = 0; ix < count; ++ix, src += 8, out += 12)
+	{
+		uint64_t value;
+		memcpy(&value, src, 8);
+		value = htobe64(value);
+		memcpy(out, &length, 4);
+		memcpy(out + 4, &value, 8);
+	}
+}
+
+#ifdef UVPG_X86_KERNELS
+// the length words are shuffled in as zeros (-128 in a pshufb mask), then or'd with the
+// big endian length.
+
+__attribute__((target("ssse3")))
+static void uvpg_encode16_ssse3(char *out, const void *in, size_t count)
+{
+	// 8 values (16 bytes) in, 48 bytes out.
+	const __m128i shuf0 = _mm_setr_epi8(-128,-128,-128,-128,1,0,-128,-128,-128,-128,3,2,-128,-128,-128,-128);
+	const __m128i shuf1 = _mm_setr_epi8(5,4,-128,-128,-128,-128,7,6,-128,-128,-128,-128,9,8,-128,-128);
+	const __m128i shuf2 = _mm_setr_epi8(-128,-128,11,10,-128,-128,-128,-128,13,12,-128,-128,-128,-128,15,14);
+	const __m128i len0 = _mm_setr_epi8(0,0,0,2,0,0,0,0,0,2,0,0,0,0,0,2);
+	const __m128i len1 = _mm_setr_epi8(0,0,0,0,0,2,0,0,0,0,0,2,0,0,0,0);
+	const __m128i len2 = _mm_setr_epi8(0,2,0,0,0,0,0,2,0,0,0,0,0,2,0,0);
+	const char *src = (const char *)in;
+	size_t ix = 0;
+	for(; ix + 8 <= count; ix += 8, src += 16, out += 48)
+	{
+		__m128i values = _mm_loadu_si128((const __m128i *)src);
+		_mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_shuffle_epi8(values, shuf0), len0));
+		_mm_storeu_si128((__m128i *)(out + 16), _mm_or_si128(_mm_shuffle_epi8(values, shuf1), len1));
+		_mm_storeu_si128((__m128i *)(out + 32), _mm_or_si128(_mm_shuffle_epi8(values, shuf2), len2));
+	}
+	uvpg_encode16_scalar(out, src, count - ix);
+}
+
+__attribute__((target("ssse3")))
+static void uvpg_encode32_ssse3(char *out, const void *in, size_t count)
+{
+	// 4 values in, interleaved with the length words.
+	const __m128i swap = _mm_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	const __m128i length = _mm_set1_epi32(0x04000000);
+	const char *src = (const char *)in;
+	size_t ix = 0;
+	for(; ix + 4 <= count; ix += 4, src += 16, out += 32)
+	{
+		__m128i values = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), swap);
+		_mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi32(length, values));
+		_mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi32(length, values));
+	}
+	uvpg_encode32_scalar(out, src, count - ix);
+}
+
+__attribute__((target("ssse3")))
+static void uvpg_encode64_ssse3(char *out, const void *in, size_t count)
+{
+	// 2 values in, 24 bytes out: length, first value, length; then the second value.
+	const __m128i shuf0 = _mm_setr_epi8(-128,-128,-128,-128,7,6,5,4,3,2,1,0,-128,-128,-128,-128);
+	const __m128i shuf1 = _mm_setr_epi8(15,14,13,12,11,10,9,8,-128,-128,-128,-128,-128,-128,-128,-128);
+	const __m128i len0 = _mm_setr_epi8(0,0,0,8,0,0,0,0,0,0,0,0,0,0,0,8);
+	const char *src = (const char *)in;
+	size_t ix = 0;
+	for(; ix + 2 <= count; ix += 2, src += 16, out += 24)
+	{
+		__m128i values = _mm_loadu_si128((const __m128i *)src);
+		_mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_shuffle_epi8(values, shuf0), len0));
+		_mm_storel_epi64((__m128i *)(out + 16), _mm_shuffle_epi8(values, shuf1));
+	}
+	uvpg_encode64_scalar(out, src, count - ix);
+}
+
+__attribute__((target("avx2")))
+static void uvpg_encode32_avx2(char *out, const void *in, size_t count)
+{
+	// 8 values in.  unpack works within each 128 bit lane, so the halves get put back in order.
+	const __m256i swap = _mm256_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+										  3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	const __m256i length = _mm256_set1_epi32(0x04000000);
+	const char *src = (const char *)in;
+	size_t ix = 0;
+	for(; ix + 8 <= count; ix += 8, src += 32, out += 64)
+	{
+		__m256i values = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), swap);
+		__m256i lo = _mm256_unpacklo_epi32(length, values);
+		__m256i hi = _mm256_unpackhi_epi32(length, values);
+		_mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(out + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	uvpg_encode32_ssse3(out, src, count - ix);
+}
+
+__attribute__((target("avx2")))
+static void uvpg_encode64_avx2(char *out, const void *in, size_t count)
+{
+	// 4 values in, 48 bytes out.  As 32 bit words, with the values swapped to w0..w7:
+	// L w0 w1 L w2 w3 L w4 | w5 L w6 w7
+	const __m256i swap = _mm256_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+										  7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+	const __m256i spread = _mm256_setr_epi32(0, 0, 1, 0, 2, 3, 0, 4);
+	const __m256i length = _mm256_set1_epi32(0x08000000);
+	const char *src = (const char *)in;
+	size_t ix = 0;
+	for(; ix + 4 <= count; ix += 4, src += 32, out += 48)
+	{
+		__m256i values = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), swap);
+		__m256i first = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(values, spread), length, 0x49);
+		__m128i rest = _mm_shuffle_epi32(_mm256_extracti128_si256(values, 1), _MM_SHUFFLE(3, 2, 0, 1));
+		rest = _mm_blend_epi32(rest, _mm256_castsi256_si128(length), 0x02);
+		_mm256_storeu_si256((__m256i *)out, first);
+		_mm_storeu_si128((__m128i *)(out + 32), rest);
+	}
+	uvpg_encode64_ssse3(out, src, count - ix);
+}
+#endif
+
+class uvpg_encode_kernels
+{
+public:
+	uvpg_encode_kernels()
+	: encode16(uvpg_encode16_scalar), encode32(uvpg_encode32_scalar), encode64(uvpg_encode64_scalar), name("scalar")
+	{
+#ifdef UVPG_X86_KERNELS
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("ssse3"))
+		{
+			encode16 = uvpg_encode16_ssse3;
+			encode32 = uvpg_encode32_ssse3;
+			encode64 = uvpg_encode64_ssse3;
+			name = "ssse3";
+		}
+		if(__builtin_cpu_supports("avx2"))
+		{
+			encode32 = uvpg_encode32_avx2;
+			encode64 = uvpg_encode64_avx2;
+			name = "avx2";
+		}
+#endif
+	};
+	uvpg_encode_fn encode16;
+	uvpg_encode_fn encode32;
+	uvpg_encode_fn encode64;
+	const char *name;
+};
+
+static const uvpg_encode_kernels &uvpg_kernels()
+{
+	static uvpg_encode_kernels kernels;
+	return kernels;
+}
+
+void uvpg_encode_elements16(char *out, const void *in, size_t count)
+{
+	uvpg_kernels().encode16(out, in, count);
+}
+
+void uvpg_encode_elements32(char *out, const void *in, size_t count)
+{
+	uvpg_kernels().encode32(out, in, count);
+}
+
+void uvpg_encode_elements64(char *out, const void *in, size_t count)
+{
+	uvpg_kernels().encode64(out, in, count);
+}
+
+const char *uvpg_encode_kernel()
+{
+	return uvpg_kernels().name;
+}
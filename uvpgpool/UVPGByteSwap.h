@@ -0,0 +1,50 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  UVPGByteSwap.h
+//  UVPGPool
+//
+
+#ifndef __UVPGByteSwap__
+#define __UVPGByteSwap__
+
+#include <stddef.h>
+
+// the elements of a binary array parameter, as postgres wants them: each value in network
+// byte order, behind a 4 byte length.  Writes count * (4 + size) bytes to out; in needn't
+// be aligned.  Uses SSSE3 or AVX2 shuffles when the cpu has them (checked once, at first
+// use), plain htobe*() otherwise.
+void uvpg_encode_elements16(char *out, const void *in, size_t count);
+void uvpg_encode_elements32(char *out, const void *in, size_t count);
+void uvpg_encode_elements64(char *out, const void *in, size_t count);
+
+// which of the above is in use: "avx2", "ssse3" or "scalar".
+const char *uvpg_encode_kernel();
+
+#endif /* defined(__UVPGByteSwap__) */
@@ -0,0 +1,387 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+//
+//  UVPGCopy.cpp
+//  UVPGPool
+//
+
+#include "UVPGCopy.h"
+#include "byteorder_endian.h"
+
+#include <assert.h>
+
+//
+// UVPGCopyRows
+//
+
+void UVPGCopyRows::append(const void *data, size_t length)
+{
+	const char *bytes = (const char *)data;
+	buffer.insert(buffer.end(), bytes, bytes + length);
+}
+
+void UVPGCopyRows::add(UVPGParams &row)
+{
+	if(!header_written)
+	{
+		// signature, flags, header extension length.
+		static const char signature[11] = { 'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0' };
+		uint32_t zero = 0;
+		append(signature, sizeof(signature));
+		append(&zero, sizeof(zero));
+		append(&zero, sizeof(zero));
+		header_written = true;
+	}
+	size_t count = row.size();
+	const char * const *values = row.values();
+	const int *lengths = row.lengths();
+	uint16_t fields = htobe16((uint16_t)count);
+	append(&fields, sizeof(fields));
+	for(size_t ix = 0; ix < count; ++ix)
+	{
+		int32_t length = values[ix] ? lengths[ix] : -1;
+		uint32_t belength = htobe32((uint32_t)length);
+		append(&belength, sizeof(belength));
+		if(length > 0)
+			append(values[ix], length);
+	}
+}
+
+void UVPGCopyRows::finish()
+{
+	uint16_t trailer = htobe16((uint16_t)-1);
+	append(&trailer, sizeof(trailer));
+}
+
+//
+// UVPGCopy
+//
+
+static void uvpg_copy_poll(uv_poll_t *poll, int status, int events)
+{
+	uvpg_result *reader = (uvpg_result *)poll->data;
+	assert(reader != NULL);
+	UVPGCopy *copy = (UVPGCopy *)reader->data;
+	if(status != 0)
+		copy->fail();
+	else if(events & UV_WRITABLE)
+		copy->writable();
+	else if(events & UV_READABLE)
+		copy->readable();
+}
+
+static void uvpg_copy_failure(uv_timer_t *timer, int status)
+{
+	UVPGCopy *copy = (UVPGCopy *)timer->data;
+	copy->failed(copy->entry->conn);
+}
+
+static void uvpg_copy_closed(uv_handle_t *handle)
+{
+	delete (UVPGCopy *)handle->data;
+}
+
+void uvpg_copy_started(PGconn *conn, void *data)
+{
+	UVPGCopy *copy = (UVPGCopy *)data;
+	PGresult *res = PQgetResult(conn);
+	ExecStatusType resstatus = PQresultStatus(res);
+	PQclear(res);
+	if(resstatus != copy->copy_status)
+	{
+		printf("COPY didn't start: %s\n", PQerrorMessage(conn));
+		copy->failed(conn);
+		return;
+	}
+	copy->begin(conn);
+}
+
+void uvpg_copy_failed(PGconn *conn, void *data)
+{
+	UVPGCopy *copy = (UVPGCopy *)data;
+	copy->failed(conn);
+}
+
+UVPGCopy::UVPGCopy(UVPGPool *in_pool, void *in_data, ExecStatusType in_copy_status, uvpg_result_cb in_done_cb, uvpg_result_cb in_failure_cb)
+: pool(in_pool), entry(NULL), reader(NULL), data(in_data), copy_status(in_copy_status),
+  done_cb(in_done_cb), failure_cb(in_failure_cb), stage(cp_starting)
+{
+	uv_timer_init(pool->eventloop, &timer);
+	timer.data = this;
+}
+UVPGCopy::~UVPGCopy()
+{
+	pool->releaseResult(reader);
+}
+
+void UVPGCopy::begin(PGconn *conn)
+{
+	entry = pool->findConnEntry(conn);
+	stage = cp_copying;
+	reader = pool->newResultStruct();
+	reader->entry = entry;
+	reader->data = this;
+	entry->poller->data = reader;
+}
+
+void UVPGCopy::detach()
+{
+	// hand the poller back the way we found it.
+	pool->setPollEvents(entry, UV_READABLE, NULL);
+	entry->poller->data = NULL;
+	pool->releaseResult(reader);
+	reader = NULL;
+}
+
+void UVPGCopy::finish()
+{
+	// done_cb picks up the final result, same as any other query.
+	detach();
+	done_cb(entry->conn, data);
+	destroy();
+}
+
+void UVPGCopy::fail()
+{
+	if(stage == cp_failed)
+		return;
+	stage = cp_failed;
+	detach();
+	uv_timer_start(&timer, uvpg_copy_failure, 0, 0);
+}
+
+void UVPGCopy::failed(PGconn *conn)
+{
+	// validating the returned connection gets it out of the COPY (by resetting it, if need be).
+	if(failure_cb)
+		failure_cb(conn, data);
+	else
+		done_cb(conn, data);
+	destroy();
+}
+
+void UVPGCopy::destroy()
+{
+	uv_close((uv_handle_t *)&timer, uvpg_copy_closed);
+}
+
+//
+// UVPGCopyIn
+//
+
+UVPGCopyIn::UVPGCopyIn(UVPGPool *in_pool, void *in_data, uvpg_copy_cb in_write_cb, uvpg_result_cb in_done_cb, uvpg_result_cb in_failure_cb)
+: UVPGCopy(in_pool, in_data, PGRES_COPY_IN, in_done_cb, in_failure_cb), write_cb(in_write_cb), backlog(false)
+{
+}
+
+void UVPGCopyIn::begin(PGconn *conn)
+{
+	UVPGCopy::begin(conn);
+	write_cb(this, data);
+}
+
+bool UVPGCopyIn::write(const char *buffer, size_t length)
+{
+	bool queued;
+	return write(buffer, length, queued);
+}
+bool UVPGCopyIn::write(UVPGCopyRows &rows)
+{
+	bool queued;
+	bool more = write(rows.data(), rows.size(), queued);
+	if(queued)
+		rows.clear(); // either sent or in libpq's buffer.
+	return more;
+}
+bool UVPGCopyIn::write(const char *buffer, size_t length, bool &queued)
+{
+	// 'queued': libpq has the data, whether or not it could all be sent yet.
+	queued = false;
+	if(stage != cp_copying || backlog)
+		return false;
+	if(PQputCopyData(entry->conn, buffer, (int)length) != 1)
+	{
+		fail();
+		return false;
+	}
+	queued = true;
+	return flush();
+}
+
+void UVPGCopyIn::end(const char *errormsg)
+{
+	if(stage != cp_copying)
+		return;
+	stage = cp_ending;
+	if(PQputCopyEnd(entry->conn, errormsg) != 1)
+	{
+		fail();
+		return;
+	}
+	if(flush())
+		pool->setPollEvents(entry, UV_READABLE, uvpg_copy_poll);
+}
+
+bool UVPGCopyIn::flush()
+{
+	int res = PQflush(entry->conn);
+	if(res == 0)
+		return true;
+	if(res < 0)
+	{
+		fail();
+		return false;
+	}
+	backlog = true;
+	pool->setPollEvents(entry, UV_WRITABLE, uvpg_copy_poll);
+	return false;
+}
+
+void UVPGCopyIn::writable()
+{
+	int res = PQflush(entry->conn);
+	if(res == 1)
+		return; // still more to go.
+	if(res < 0)
+	{
+		fail();
+		return;
+	}
+	backlog = false;
+	if(stage == cp_ending)
+	{
+		// everything's out, now for the server's verdict.
+		pool->setPollEvents(entry, UV_READABLE, uvpg_copy_poll);
+		return;
+	}
+	pool->setPollEvents(entry, 0, uvpg_copy_poll);
+	write_cb(this, data);
+}
+
+void UVPGCopyIn::readable()
+{
+	if(PQconsumeInput(entry->conn) == 0)
+	{
+		fail();
+		return;
+	}
+	if(PQisBusy(entry->conn) == 0)
+		finish();
+}
+
+//
+// UVPGCopyOut
+//
+
+UVPGCopyOut::UVPGCopyOut(UVPGPool *in_pool, void *in_data, uvpg_copy_data_cb in_data_cb, uvpg_result_cb in_done_cb, uvpg_result_cb in_failure_cb)
+: UVPGCopy(in_pool, in_data, PGRES_COPY_OUT, in_done_cb, in_failure_cb), data_cb(in_data_cb), paused(false), draining(false)
+{
+}
+
+void UVPGCopyOut::begin(PGconn *conn)
+{
+	UVPGCopy::begin(conn);
+	// whatever came in with the COPY response is already buffered.
+	drain();
+}
+
+void UVPGCopyOut::pause()
+{
+	if(stage != cp_copying || paused)
+		return;
+	paused = true;
+	if(!draining)
+		pool->setPollEvents(entry, 0, uvpg_copy_poll);
+}
+
+void UVPGCopyOut::resume()
+{
+	if(stage != cp_copying || !paused)
+		return;
+	paused = false;
+	if(!draining)
+		drain();
+}
+
+void UVPGCopyOut::readable()
+{
+	if(PQconsumeInput(entry->conn) == 0)
+	{
+		fail();
+		return;
+	}
+	if(stage == cp_ending)
+	{
+		if(PQisBusy(entry->conn) == 0)
+			finish();
+		return;
+	}
+	drain();
+}
+
+void UVPGCopyOut::drain()
+{
+	// hand over everything libpq has a whole row of, without waiting for more.
+	draining = true;
+	while(!paused)
+	{
+		char *buffer = NULL;
+		int length = PQgetCopyData(entry->conn, &buffer, 1);
+		if(length > 0)
+		{
+			data_cb(this, buffer, length, data);
+			PQfreemem(buffer);
+			if(stage != cp_copying)
+				break; // the callback managed to break the connection.
+			continue;
+		}
+		draining = false;
+		if(length == 0)
+		{
+			pool->setPollEvents(entry, UV_READABLE, uvpg_copy_poll);
+			return;
+		}
+		if(length == -2)
+		{
+			fail();
+			return;
+		}
+		// -1: that was the last of it, the COPY's result follows.
+		stage = cp_ending;
+		if(PQisBusy(entry->conn) == 0)
+			finish();
+		else
+			pool->setPollEvents(entry, UV_READABLE, uvpg_copy_poll);
+		return;
+	}
+	draining = false;
+	if(paused)
+		pool->setPollEvents(entry, 0, uvpg_copy_poll);
+}
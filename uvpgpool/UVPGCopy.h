@@ -0,0 +1,155 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+//
+//  UVPGCopy.h
+//  UVPGPool
+//
+
+#ifndef __UVPGCopy__
+#define __UVPGCopy__
+
+#include "UVPGPool.h"
+#include "UVPGParams.h"
+
+#include <vector>
+
+// encodes rows for COPY ... FROM STDIN (FORMAT binary): each UVPGParams is a row, each of its
+// parameters a column, using the same binary encodings the parameters already have.  Text
+// parameters go out as-is, which is what binary COPY expects for text/varchar columns.
+class UVPGCopyRows
+{
+private:
+	std::vector<char> buffer;
+	bool header_written;
+	
+	void append(const void *data, size_t length);
+	
+public:
+	UVPGCopyRows() : header_written(false) { };
+	
+	void add(UVPGParams &row);
+	void finish(); // the end-of-data marker, after the last row.
+	
+	const char *data() { return buffer.empty() ? NULL : &buffer[0]; }
+	size_t size() { return buffer.size(); }
+	void clear() { buffer.clear(); } // after writing it out; the header only ever goes out once.
+};
+
+// what both directions of COPY have in common: the connection (taken over from the query
+// which started the COPY), and reporting back.  Owned by the pool, gone once done_cb or
+// failure_cb has been called.
+class UVPGCopy
+{
+public:
+	enum { cp_starting, cp_copying, cp_ending, cp_failed };
+	
+	UVPGCopy(UVPGPool *in_pool, void *in_data, ExecStatusType in_copy_status, uvpg_result_cb in_done_cb, uvpg_result_cb in_failure_cb);
+	virtual ~UVPGCopy();
+	
+	UVPGPool *pool;
+	UVPGConnEntry *entry;
+	uvpg_result *reader; // what the connection's poller points at while we have it.
+	uv_timer_t timer; // failures are reported from here, never from inside a call into us.
+	void *data;
+	ExecStatusType copy_status; // PGRES_COPY_IN or PGRES_COPY_OUT.
+	uvpg_result_cb done_cb;
+	uvpg_result_cb failure_cb;
+	int stage;
+	
+	// used internally.
+	virtual void begin(PGconn *conn);
+	virtual void writable() { };
+	virtual void readable() = 0;
+	void finish();
+	void fail();
+	void failed(PGconn *conn);
+	void destroy();
+	
+protected:
+	void detach();
+};
+
+// a connection in COPY FROM STDIN, from UVPGPool::copyIn().  Pool connections are in
+// non-blocking mode, so write() never waits on the server: once libpq can't
+// get everything onto the socket, write() returns false and the COPY waits for the socket to
+// become writable, then calls write_cb again.
+class UVPGCopyIn : public UVPGCopy
+{
+public:
+	UVPGCopyIn(UVPGPool *in_pool, void *in_data, uvpg_copy_cb in_write_cb, uvpg_result_cb in_done_cb, uvpg_result_cb in_failure_cb);
+	
+	uvpg_copy_cb write_cb;
+	bool backlog; // libpq has unsent data, waiting on UV_WRITABLE.
+	
+	// true: keep going.  false: wait for write_cb (or failure_cb, if the connection gave out).
+	bool write(const char *buffer, size_t length);
+	bool write(UVPGCopyRows &rows);
+	// finish the COPY (or abort it, with an error message); done_cb follows.
+	void end(const char *errormsg=NULL);
+	
+	// used internally.
+	void begin(PGconn *conn);
+	void writable();
+	void readable();
+	
+private:
+	bool write(const char *buffer, size_t length, bool &queued);
+	bool flush();
+};
+
+// a connection in COPY TO STDOUT, from UVPGPool::copyOut().  data_cb gets each row (or chunk)
+// as libpq assembles it, only valid for the duration of the callback.  pause() stops reading
+// the socket, so a slow consumer pushes back on the server rather than piling up in memory;
+// resume() picks up where it left off.
+class UVPGCopyOut : public UVPGCopy
+{
+public:
+	UVPGCopyOut(UVPGPool *in_pool, void *in_data, uvpg_copy_data_cb in_data_cb, uvpg_result_cb in_done_cb, uvpg_result_cb in_failure_cb);
+	
+	uvpg_copy_data_cb data_cb;
+	bool paused;
+	bool draining; // inside drain(), so resume() from data_cb doesn't recurse.
+	
+	void pause();
+	void resume();
+	
+	// used internally.
+	void begin(PGconn *conn);
+	void readable();
+	
+private:
+	void drain();
+};
+
+// uvpg_result_cb's for getting a COPY (in either direction) started.
+void uvpg_copy_started(PGconn *conn, void *data);
+void uvpg_copy_failed(PGconn *conn, void *data);
+
+#endif /* defined(__UVPGCopy__) */
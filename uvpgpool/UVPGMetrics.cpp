@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+//
+//  UVPGMetrics.cpp
+//  UVPGPool
+//
+
+#include "UVPGMetrics.h"
+#include <stdio.h>
+
+// Prometheus bucket boundaries, in seconds.
+static const double uvpg_text_buckets[] = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+
+//
+// UVPGHistogram
+//
+
+UVPGHistogram::UVPGHistogram() : count(0), sum(0), max(0)
+{
+	for(size_t ix = 0; ix < UVPG_HIST_BUCKETS; ++ix)
+		buckets[ix].store(0, std::memory_order_relaxed);
+}
+
+size_t UVPGHistogram::bucketIndex(uint64_t value)
+{
+	// below UVPG_HIST_SUB_COUNT every value has a bucket of its own; above, the top
+	// UVPG_HIST_SUB_BITS bits after the leading one pick the bucket within its power of two.
+	if(value < UVPG_HIST_SUB_COUNT)
+		return (size_t)value;
+	unsigned exponent = 63 - __builtin_clzll(value);
+	size_t sub = (size_t)(value >> (exponent - UVPG_HIST_SUB_BITS)) & (UVPG_HIST_SUB_COUNT - 1);
+	return (exponent - UVPG_HIST_SUB_BITS + 1) * UVPG_HIST_SUB_COUNT + sub;
+}
+
+uint64_t UVPGHistogram::bucketLimit(size_t index)
+{
+	if(index < UVPG_HIST_SUB_COUNT)
+		return index;
+	unsigned exponent = (unsigned)(index / UVPG_HIST_SUB_COUNT) + UVPG_HIST_SUB_BITS - 1;
+	uint64_t width = 1ULL << (exponent - UVPG_HIST_SUB_BITS);
+	uint64_t lowest = (uint64_t)(UVPG_HIST_SUB_COUNT + index % UVPG_HIST_SUB_COUNT) << (exponent - UVPG_HIST_SUB_BITS);
+	return lowest + (width - 1);
+}
+
+void UVPGHistogram::record(uint64_t value)
+{
+	buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(value, std::memory_order_relaxed);
+	uint64_t highest = max.load(std::memory_order_relaxed);
+	while(value > highest && !max.compare_exchange_weak(highest, value, std::memory_order_relaxed))
+		;
+}
+
+void UVPGHistogram::snapshot(uvpg_histogram_snapshot &out) const
+{
+	// not one atomic copy, so a record() landing halfway through can leave count a little off
+	// from the buckets; fine for what this is used for.
+	out.buckets.resize(UVPG_HIST_BUCKETS);
+	for(size_t ix = 0; ix < UVPG_HIST_BUCKETS; ++ix)
+		out.buckets[ix] = buckets[ix].load(std::memory_order_relaxed);
+	out.count = count.load(std::memory_order_relaxed);
+	out.sum = sum.load(std::memory_order_relaxed);
+	out.max = max.load(std::memory_order_relaxed);
+}
+
+//
+// uvpg_histogram_snapshot
+//
+
+uint64_t uvpg_histogram_snapshot::percentile(double pct) const
+{
+	uint64_t total = 0;
+	for(size_t ix = 0; ix < buckets.size(); ++ix)
+		total += buckets[ix];
+	if(total == 0)
+		return 0;
+	uint64_t wanted = (uint64_t)(total * pct / 100.0 + 0.5);
+	if(wanted == 0)
+		wanted = 1;
+	uint64_t seen = 0;
+	for(size_t ix = 0; ix < buckets.size(); ++ix)
+	{
+		seen += buckets[ix];
+		if(seen >= wanted)
+		{
+			uint64_t limit = UVPGHistogram::bucketLimit(ix);
+			return limit < max ? limit : max;
+		}
+	}
+	return max;
+}
+
+uint64_t uvpg_histogram_snapshot::countAtMost(uint64_t limit) const
+{
+	uint64_t seen = 0;
+	for(size_t ix = 0; ix < buckets.size() && UVPGHistogram::bucketLimit(ix) <= limit; ++ix)
+		seen += buckets[ix];
+	return seen;
+}
+
+void uvpg_histogram_text(std::string &out, const char *name, const char *help, const uvpg_histogram_snapshot &hist)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	out += line;
+	for(size_t ix = 0; ix < sizeof(uvpg_text_buckets) / sizeof(uvpg_text_buckets[0]); ++ix)
+	{
+		uint64_t limit = (uint64_t)(uvpg_text_buckets[ix] * 1000000.0);
+		snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n", name, uvpg_text_buckets[ix], (unsigned long long)hist.countAtMost(limit));
+		out += line;
+	}
+	snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.6f\n%s_count %llu\n", name, (unsigned long long)hist.count,
+			 name, hist.sum / 1000000.0, name, (unsigned long long)hist.count);
+	out += line;
+}
@@ -0,0 +1,121 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+//
+//  UVPGMetrics.h
+//  UVPGPool
+//
+
+#ifndef __UVPGMetrics__
+#define __UVPGMetrics__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// histogram precision: each power of two is split into 2^UVPG_HIST_SUB_BITS buckets, so a
+// recorded value is off by at most 1/16th (about 6%), whatever its size.
+#define UVPG_HIST_SUB_BITS 4
+#define UVPG_HIST_SUB_COUNT (1 << UVPG_HIST_SUB_BITS)
+#define UVPG_HIST_BUCKETS ((64 - UVPG_HIST_SUB_BITS + 1) * UVPG_HIST_SUB_COUNT)
+
+// a copy of a histogram at some point, safe to read at leisure.  Values are in microseconds.
+class uvpg_histogram_snapshot
+{
+public:
+	uvpg_histogram_snapshot() : count(0), sum(0), max(0) { };
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	std::vector<uint64_t> buckets; // UVPG_HIST_BUCKETS of them, see UVPGHistogram.
+	
+	double mean() const { return count ? (double)sum / count : 0.0; };
+	// the value pct percent (0-100) of recorded values are at or below, to within a bucket.
+	uint64_t percentile(double pct) const;
+	// how many recorded values are at or below limit, to within a bucket.
+	uint64_t countAtMost(uint64_t limit) const;
+};
+
+// HDR style (log-linear) histogram.  Recording is a few relaxed atomic adds, no locks, so any
+// thread can record while any other takes a snapshot.
+class UVPGHistogram
+{
+public:
+	UVPGHistogram();
+	void record(uint64_t value);
+	void snapshot(uvpg_histogram_snapshot &out) const;
+	
+	static size_t bucketIndex(uint64_t value);
+	static uint64_t bucketLimit(size_t index); // the largest value that lands in that bucket.
+	
+private:
+	std::atomic<uint64_t> buckets[UVPG_HIST_BUCKETS];
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> max;
+};
+
+// what UVPGPool measures as it goes.  All times are microseconds.
+class UVPGPoolMetrics
+{
+public:
+	UVPGPoolMetrics() : queries(0), failures(0), timeouts(0), coalesced(0) { };
+	UVPGHistogram acquire_wait; // asking for a query until it had a connection (0 if one was free).
+	UVPGHistogram queue_wait; // queries that had to wait: time spent in the queue.
+	UVPGHistogram first_byte; // query sent until the first of its result came in.
+	UVPGHistogram query_time; // asking for a query until its result was handed over.
+	std::atomic<uint64_t> queries; // results handed over.
+	std::atomic<uint64_t> failures; // failure callbacks (including timeouts).
+	std::atomic<uint64_t> timeouts;
+	std::atomic<uint64_t> coalesced; // sharedQueryAndDo() calls which joined a query already on its way.
+};
+
+// UVPGPool::getMetrics(), a point-in-time view of the pool.
+#define UVPG_CONN_STATES 8
+class uvpg_pool_snapshot
+{
+public:
+	unsigned states[UVPG_CONN_STATES]; // connections in each ConnStatus (cs_invalid...cs_pipelined).
+	unsigned pending; // queries waiting for a connection.
+	uint64_t queries;
+	uint64_t failures;
+	uint64_t timeouts;
+	uint64_t coalesced;
+	uvpg_histogram_snapshot acquire_wait;
+	uvpg_histogram_snapshot queue_wait;
+	uvpg_histogram_snapshot first_byte;
+	uvpg_histogram_snapshot query_time;
+};
+
+// Prometheus text format: a histogram as name_bucket/_sum/_count, in seconds.
+void uvpg_histogram_text(std::string &out, const char *name, const char *help, const uvpg_histogram_snapshot &hist);
+
+#endif /* defined(__UVPGMetrics__) */
@@ -36,8 +36,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "UVPGParams.h"
 #include "byteorder_endian.h"
+#include "UVPGByteSwap.h"
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
 
 UVPGParams::UVPGParams()
 : param_count(0), alloc_data(NULL), alloc_pos(0), alloc_size(0)
@@ -52,42 +57,117 @@ UVPGParams::UVPGParams(size_t starting_size)
 UVPGParams::UVPGParams(const UVPGParams &rhs)
 : param_count(0), alloc_data(NULL), alloc_pos(0), alloc_size(0)
 {
-	// copy, allocating our own space for all paramters.
-	// UVPGParams is neigh-guaranteed to be populated with lenghts, formats & oids
+	assign(rhs.arrays());
+}
+UVPGParams::UVPGParams(UVPGParams &&rhs)
+: param_count(0), alloc_data(NULL), alloc_pos(0), alloc_size(0)
+{
+	*this = std::move(rhs);
+}
+
+UVPGParams::~UVPGParams()
+{
+	if(alloc_data)
+		free(alloc_data);
+}
+
+UVPGParams &UVPGParams::operator=(const UVPGParams &rhs)
+{
+	if(this != &rhs)
+		assign(rhs.arrays());
+	return *this;
+}
+UVPGParams &UVPGParams::operator=(UVPGParams &&rhs)
+{
+	// take over rhs's parameters and memory, leaving it with ours (emptied) to reuse.
+	if(this == &rhs)
+		return *this;
+	clear();
+	std::swap(param_count, rhs.param_count);
+	param_values.swap(rhs.param_values);
+	param_length.swap(rhs.param_length);
+	param_format.swap(rhs.param_format);
+	param_oid.swap(rhs.param_oid);
+	param_offset.swap(rhs.param_offset);
+	std::swap(alloc_data, rhs.alloc_data);
+	std::swap(alloc_pos, rhs.alloc_pos);
+	std::swap(alloc_size, rhs.alloc_size);
+	return *this;
+}
+
+// same defaults as libpq: no formats is all text, and text goes by strlen().
+static inline int uvpg_param_format(const uvpg_param_arrays &params, int ix)
+{
+	return params.formats ? params.formats[ix] : FORMAT_TEXT;
+}
+static inline int uvpg_param_length(const uvpg_param_arrays &params, int ix)
+{
+	const char *value = params.values[ix];
+	if(value == NULL)
+		return 0;
+	if(uvpg_param_format(params, ix) == FORMAT_BINARY)
+		return params.lengths[ix];
+	return (int)strlen(value);
+}
+
+void UVPGParams::assign(const uvpg_param_arrays &params)
+{
+	// copy, allocating our own space for all paramters (reusing what we have, if we can).
+	clear();
 	size_t param_size = 0;
-	for(int ix = 0; ix < rhs.param_count; ++ix)
+	for(int ix = 0; ix < params.count; ++ix)
 	{
-		param_size += rhs.param_length[ix];
+		param_size += uvpg_param_length(params, ix) + 1;
 	}
-	set_param_size(param_size / sizeof(int64_t));
+	if(param_size > alloc_size)
+		grow(param_size);
+	set_param_size(params.count);
 	// get & copy all parameters
-	for(int ix = 0; ix < rhs.param_count; ++ix)
+	for(int ix = 0; ix < params.count; ++ix)
 	{
-		add(rhs.param_values[ix], rhs.param_length[ix], rhs.param_format[ix], rhs.param_oid[ix], true);
+		add(params.values[ix], uvpg_param_length(params, ix), uvpg_param_format(params, ix),
+			params.oids ? params.oids[ix] : 0, true);
 	}
 }
 
-UVPGParams::~UVPGParams()
+void UVPGParams::clear()
 {
-	if(alloc_data)
-		free(alloc_data);
+	param_count = 0;
+	param_values.clear();
+	param_length.clear();
+	param_format.clear();
+	param_oid.clear();
+	param_offset.clear();
+	alloc_pos = 0;
+}
+
+void UVPGParams::grow(size_t size)
+{
+	char *newmem = (char *)realloc(alloc_data, size);
+	if(newmem == NULL)
+	{
+		printf("Error allocating memory for UVPGParams.\n");
+		throw "";
+	}
+	alloc_data = newmem;
+	alloc_size = size;
+	// the block may have moved, taking the values we've already added with it.
+	for(size_t ix = 0; ix < param_count; ++ix)
+	{
+		if(param_offset[ix] >= 0)
+			param_values[ix] = alloc_data + param_offset[ix];
+	}
 }
 
 char *UVPGParams::alloc(size_t size)
 {
 	if(alloc_pos + size > alloc_size)
 	{
-		char *newmem = (char *)realloc(alloc_data, alloc_pos + size);
-		if(newmem == NULL)
-		{
-			printf("Error allocating memory for UVPGParams.\n");
-			throw "";
-		}
-		else
-		{
-			alloc_data = newmem;
-			alloc_size = alloc_pos + size;
-		}
+		// double it, so that a lot of adds don't mean a lot of reallocs.
+		size_t new_size = alloc_size * 2;
+		if(new_size < alloc_pos + size)
+			new_size = alloc_pos + size;
+		grow(new_size);
 	}
 	char *mem = &(alloc_data[alloc_pos]);
 	alloc_pos += size;
@@ -97,17 +177,26 @@ char *UVPGParams::alloc(size_t size)
 inline void UVPGParams::add(const char *input, int length, int format, Oid oid, bool dup)
 {
 	const char *data = input;
-	if(dup)
+	int offset = -1;
+	if(dup && input != NULL)
 	{
-		// we probably only want to dup if we're using the copy constructor
-		char *mem = alloc(length);
+		// we probably only want to dup if we're copying.  Text parameters get a
+		// terminator, since libpq goes by strlen() rather than the length for those.
+		char *mem = alloc(length + 1);
 		memcpy(mem, input, length);
+		mem[length] = '\0';
 		data = mem;
+		offset = (int)(mem - alloc_data);
+	}
+	else if(input >= alloc_data && input < alloc_data + alloc_pos)
+	{
+		offset = (int)(input - alloc_data);
 	}
 	param_values.push_back(data);
 	param_length.push_back(length);
 	param_format.push_back(format);
 	param_oid.push_back(oid);
+	param_offset.push_back(offset);
 	++param_count;
 }
 
@@ -119,19 +208,7 @@ bool UVPGParams::set_param_size(const size_t size)
 	// all on the fly later, we'll need it.
 	size_t new_alloc_data_size = (size + 1) * sizeof(int64_t);
 	if(new_alloc_data_size > alloc_size)
-	{
-		char *newmem = (char *)realloc(alloc_data, new_alloc_data_size);
-		if(newmem == NULL)
-		{
-			printf("Error allocating memory for UVPGParams.\n");
-			throw "";
-		}
-		else
-		{
-			alloc_data = newmem;
-			alloc_size = new_alloc_data_size;
-		}
-	}
+		grow(new_alloc_data_size);
 	
 	if(param_values.capacity() < size && size > 0)
 	{
@@ -139,6 +216,7 @@ bool UVPGParams::set_param_size(const size_t size)
 		param_length.reserve(size);
 		param_format.reserve(size);
 		param_oid.reserve(size);
+		param_offset.reserve(size);
 		return true;
 	}
 	if(param_values.capacity() >= size && size > 0)
@@ -199,3 +277,68 @@ void UVPGParams::add(const double input)
 	add((char *)data, (int)sizeof(input), FORMAT_BINARY, FLOAT8OID);
 }
 
+
+char *UVPGParams::addArray(Oid element, Oid array, size_t count, size_t data_size, bool has_null)
+{
+	// array_recv() header: dimensions, null flag, element type, then size & lower bound of
+	// the one dimension (none at all, for an empty array).  The elements follow.
+	size_t header_size = count ? 5 * sizeof(int32_t) : 3 * sizeof(int32_t);
+	char *mem = alloc(header_size + data_size);
+	uint32_t header[5] = { htobe32(count ? 1 : 0), htobe32(has_null ? 1 : 0), htobe32(element),
+						   htobe32((uint32_t)count), htobe32(1) };
+	memcpy(mem, header, header_size);
+	add(mem, (int)(header_size + data_size), FORMAT_BINARY, array);
+	return mem + header_size;
+}
+void UVPGParams::add(const int16_t *input, const size_t count)
+{
+	char *elements = addArray(INT2OID, INT2ARRAYOID, count, count * (sizeof(int32_t) + sizeof(int16_t)), false);
+	uvpg_encode_elements16(elements, input, count);
+}
+void UVPGParams::add(const int32_t *input, const size_t count)
+{
+	char *elements = addArray(INT4OID, INT4ARRAYOID, count, count * (sizeof(int32_t) + sizeof(int32_t)), false);
+	uvpg_encode_elements32(elements, input, count);
+}
+void UVPGParams::add(const int64_t *input, const size_t count)
+{
+	char *elements = addArray(INT8OID, INT8ARRAYOID, count, count * (sizeof(int32_t) + sizeof(int64_t)), false);
+	uvpg_encode_elements64(elements, input, count);
+}
+void UVPGParams::add(const float *input, const size_t count)
+{
+	// same bits as a uint32_t, so the same swap.
+	char *elements = addArray(FLOAT4OID, FLOAT4ARRAYOID, count, count * (sizeof(int32_t) + sizeof(float)), false);
+	uvpg_encode_elements32(elements, input, count);
+}
+void UVPGParams::add(const double *input, const size_t count)
+{
+	char *elements = addArray(FLOAT8OID, FLOAT8ARRAYOID, count, count * (sizeof(int32_t) + sizeof(double)), false);
+	uvpg_encode_elements64(elements, input, count);
+}
+void UVPGParams::add(const char * const *input, const size_t count)
+{
+	size_t data_size = 0;
+	bool has_null = false;
+	for(size_t ix = 0; ix < count; ++ix)
+	{
+		data_size += sizeof(int32_t);
+		if(input[ix])
+			data_size += strlen(input[ix]);
+		else
+			has_null = true;
+	}
+	char *elements = addArray(TEXTOID, TEXTARRAYOID, count, data_size, has_null);
+	for(size_t ix = 0; ix < count; ++ix)
+	{
+		int32_t length = input[ix] ? (int32_t)strlen(input[ix]) : -1;
+		uint32_t be_length = htobe32((uint32_t)length);
+		memcpy(elements, &be_length, sizeof(be_length));
+		elements += sizeof(be_length);
+		if(length > 0)
+		{
+			memcpy(elements, input[ix], length);
+			elements += length;
+		}
+	}
+}
@@ -48,6 +48,22 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define FORMAT_BINARY 1
 
 
+// parameters the way PQsendQueryParams() takes them, pointing at someone else's arrays.
+// oids, lengths and formats may be NULL, as with libpq; a NULL value is an SQL NULL.
+class uvpg_param_arrays
+{
+public:
+	uvpg_param_arrays()
+	: count(0), oids(NULL), values(NULL), lengths(NULL), formats(NULL) { };
+	uvpg_param_arrays(int in_count, const Oid *in_oids, const char * const *in_values, const int *in_lengths, const int *in_formats)
+	: count(in_count), oids(in_oids), values(in_values), lengths(in_lengths), formats(in_formats) { };
+	int count;
+	const Oid *oids;
+	const char * const *values;
+	const int *lengths;
+	const int *formats;
+};
+
 class UVPGParams
 {
 private:
@@ -56,21 +72,34 @@ private:
 	std::vector<int>param_length;
 	std::vector<int>param_format;
 	std::vector<Oid>param_oid;
+	std::vector<int>param_offset; // where in alloc_data the value is, or -1 if it's the caller's.
 	
 	char *alloc_data;
 	size_t alloc_pos;
 	size_t alloc_size;
 	char *alloc(size_t size);
+	void grow(size_t size);
 	
 	void add(const char *input, int length, int format, Oid oid, bool dup=false);
+	char *addArray(Oid element, Oid array, size_t count, size_t data_size, bool has_null);
 	
 public:
 	UVPGParams();
 	UVPGParams(size_t starting_size);
 	UVPGParams(const UVPGParams &rhs);
+	UVPGParams(UVPGParams &&rhs);
 	~UVPGParams();
 	
+	UVPGParams &operator=(const UVPGParams &rhs);
+	UVPGParams &operator=(UVPGParams &&rhs);
+	
 	bool set_param_size(const size_t size);
+	void clear(); // drop all parameters, keeping the memory for reuse.
+	void assign(const uvpg_param_arrays &params); // copy of someone else's parameters.
+	uvpg_param_arrays arrays() const
+	{
+		return uvpg_param_arrays((int)param_count, param_oid.data(), param_values.data(), param_length.data(), param_format.data());
+	}
 	
 	void add(const char *input);
 	void add(const char *input, const size_t size);
@@ -79,6 +108,15 @@ public:
 	void add(const int64_t input);
 	void add(const float input);
 	void add(const double input);
+	// one dimensional arrays, sent in binary, e.g. for "WHERE id = ANY($1)".  NULL strings
+	// in a text array are NULL elements.
+	void add(const int16_t *input, const size_t count);
+	void add(const int32_t *input, const size_t count);
+	void add(const int64_t *input, const size_t count);
+	void add(const float *input, const size_t count);
+	void add(const double *input, const size_t count);
+	void add(const char * const *input, const size_t count);
+	template<class T> void add(const std::vector<T> &input) { add(input.data(), input.size()); }
 	
 	const char * const *values() { return &param_values[0]; };
 	const int *lengths() { return &param_length[0]; }
@@ -35,7 +35,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
 
 #include "UVPGPool.h"
+#include "UVPGCopy.h"
+#include <libpq-events.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <poll.h>
 #include <atomic>
 
 uint8_t ConnStatus::cs_invalid = 0;
@@ -45,6 +49,10 @@ uint8_t ConnStatus::cs_available = 3;
 uint8_t ConnStatus::cs_busy = 4;
 uint8_t ConnStatus::cs_validating = 5;
 uint8_t ConnStatus::cs_idle_ready = 6;
+uint8_t ConnStatus::cs_pipelined = 7;
+
+// by ConnStatus value, for metricsText().
+static const char *uvpg_state_names[UVPG_CONN_STATES] = { "invalid", "disconnecting", "connecting", "available", "busy", "validating", "idle_ready", "pipelined" };
 
 // two reasons for this function:
 // 1- "std::atomic_compare_exchange_strong" is too long to type/read.
@@ -57,6 +65,103 @@ inline bool atomicCAS(std::atomic<_T> *value, _T *expected, _T new_value)
 	return std::atomic_compare_exchange_strong(value, &test, new_value);
 }
 
+// only here so that each PGconn can carry a pointer back to its UVPGConnEntry
+// (PQsetInstanceData), which turns PGconn * -> entry lookups into a constant time operation.
+static int uvpg_conn_event(PGEventId evtId, void *evtInfo, void *passThrough)
+{
+	return 1;
+}
+
+static inline uvpg_conn_handle uvpg_make_handle(UVPGConnEntry *entry)
+{
+	return ((uint64_t)entry->generation.load() << 32) | entry->index;
+}
+
+// FNV-1a, good enough for telling query strings apart.
+static uint64_t uvpg_hash(const char *str)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for( ; *str; ++str)
+	{
+		hash ^= (unsigned char)*str;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// same, for a run of bytes, carrying on from 'hash' (so a key can be hashed in pieces).
+static uint64_t uvpg_hash_bytes(const char *data, size_t length, uint64_t hash = 14695981039346656037ULL)
+{
+	for(size_t ix = 0; ix < length; ++ix)
+	{
+		hash ^= (unsigned char)data[ix];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+//
+// UVPGStatementCache
+//
+
+UVPGStatementCache::lru_list::iterator UVPGStatementCache::lookup(const char *key, uint64_t hash)
+{
+	auto range = index.equal_range(hash);
+	for(auto it = range.first; it != range.second; ++it)
+	{
+		if(it->second->first == key)
+			return it->second;
+	}
+	return lru.end();
+}
+
+const char *UVPGStatementCache::find(const char *key)
+{
+	lru_list::iterator it = lookup(key, uvpg_hash(key));
+	if(it == lru.end())
+		return NULL;
+	lru.splice(lru.begin(), lru, it);
+	return it->second.c_str();
+}
+
+const char *UVPGStatementCache::add(const char *key, size_t capacity)
+{
+	while(!lru.empty() && lru.size() >= capacity)
+	{
+		// the server still has it prepared, so remember to deallocate it.
+		evicted.push_back(lru.back().second);
+		remove(lru.back().first.c_str());
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "uvpg_%u", next_id++);
+	lru.push_front(std::make_pair(std::string(key), std::string(name)));
+	index.insert(std::make_pair(uvpg_hash(key), lru.begin()));
+	return lru.front().second.c_str();
+}
+
+void UVPGStatementCache::remove(const char *key)
+{
+	uint64_t hash = uvpg_hash(key);
+	auto range = index.equal_range(hash);
+	for(auto it = range.first; it != range.second; ++it)
+	{
+		if(it->second->first == key)
+		{
+			lru.erase(it->second);
+			index.erase(it);
+			return;
+		}
+	}
+}
+
+void UVPGStatementCache::clear()
+{
+	// only for when the server side session is gone as well.
+	lru.clear();
+	index.clear();
+	evicted.clear();
+}
+
 // Query read result check.
 void uvpg_read_result(uv_poll_t *poll, int status, int events)
 {
@@ -68,43 +173,164 @@ void uvpg_read_result(uv_poll_t *poll, int status, int events)
 		assert(result != NULL);
 		UVPGConnEntry *entry = result->entry;
 		pgres = PQconsumeInput(entry->conn);
+		if(pgres != 0 && result->prepare_stage != uvpg_result::st_none)
+		{
+			// statement cache upkeep, send the next step (eventually our query) and keep waiting.
+			if(entry->pool->continuePrepare(result))
+				return;
+			pgres = 0;
+		}
 		if(pgres == 0)
 		{
 			// trouble consuming.
-			uv_poll_stop(poll);
+			entry->pool->setPollEvents(entry, UV_READABLE, NULL);
+			entry->pool->queryDone(result, true);
+			poll->data = NULL;
 			//printf("DEBUG: PG error: %s\n", PQerrorMessage(entry->conn));
 			if(result->failure_cb)
 				result->failure_cb(entry->conn, result->data);
 			else
 				result->result_cb(entry->conn, result->data);
-			poll->data = NULL;
-			delete(result);
+			entry->pool->releaseResult(result);
 			return;
 		}
+		entry->pool->firstByte(result);
 		pgres = PQisBusy(entry->conn);
 		if(pgres == 0)
 		{
-			// finished processing our request.  notify our caller.
-			uv_poll_stop(poll);
-			result->result_cb(entry->conn, result->data);
+			// finished processing our request.  notify our caller (who may put the poller to
+			// other uses, e.g. a COPY).
+			entry->pool->setPollEvents(entry, UV_READABLE, NULL);
+			entry->pool->queryDone(result, false);
 			poll->data = NULL;
-			delete(result);
+			result->result_cb(entry->conn, result->data);
+			entry->pool->releaseResult(result);
 		}
 		// ok, we checked the connection, still waiting for a result.
 	}
 }
 
+// Streamed read result check.
+void uvpg_read_stream(uv_poll_t *poll, int status, int events)
+{
+	if(status != 0 || events != UV_READABLE)
+		return;
+	uvpg_result *result = (uvpg_result *)poll->data;
+	assert(result != NULL);
+	UVPGConnEntry *entry = result->entry;
+	int pgres = PQconsumeInput(entry->conn);
+	if(pgres != 0 && result->prepare_stage != uvpg_result::st_none)
+	{
+		if(entry->pool->continuePrepare(result))
+			return;
+		pgres = 0;
+	}
+	if(pgres == 0)
+	{
+		entry->pool->setPollEvents(entry, UV_READABLE, NULL);
+		entry->pool->queryDone(result, true);
+		poll->data = NULL;
+		if(result->failure_cb)
+			result->failure_cb(entry->conn, result->data);
+		else
+			result->result_cb(entry->conn, result->data);
+		entry->pool->releaseResult(result);
+		return;
+	}
+	// hand over whatever is complete so far, memory only ever holds a row (or chunk) or so.
+	entry->pool->firstByte(result);
+	while(PQisBusy(entry->conn) == 0)
+	{
+		PGresult *res = PQgetResult(entry->conn);
+		if(res == NULL)
+		{
+			entry->pool->setPollEvents(entry, UV_READABLE, NULL);
+			entry->pool->queryDone(result, false);
+			poll->data = NULL;
+			result->result_cb(entry->conn, result->data);
+			entry->pool->releaseResult(result);
+			return;
+		}
+		result->rows_cb(res, result->data);
+		PQclear(res);
+	}
+}
+
+// Pipelined read result check.
+void uvpg_read_pipeline(uv_poll_t *poll, int status, int events)
+{
+	uvpg_result *reader = (uvpg_result *)poll->data;
+	assert(reader != NULL);
+	UVPGPool *pool = (UVPGPool *)(reader->data);
+	if(status != 0)
+		pool->pipelineFailed(reader->entry);
+	else if(events & UV_READABLE)
+		pool->pipelineReadable(reader->entry);
+}
+
+
+// Returned connection cleanup.
+void uvpg_validate_poll(uv_poll_t *poll, int status, int events)
+{
+	uvpg_result *result = (uvpg_result *)poll->data;
+	assert(result != NULL);
+	UVPGConnEntry *entry = result->entry;
+	// an error on the socket shows up as PQconsumeInput failing.
+	entry->pool->validateConnection(entry);
+}
+
+// a connection's poller, with a way back to its entry.
+struct uvpg_poller
+{
+	uv_poll_t handle; // first, so the uv_poll_t * libuv hands back is one of these.
+	UVPGConnEntry *entry;
+};
+
+static void uvpg_free_poller(uv_handle_t *handle)
+{
+	delete (uvpg_poller *)handle;
+}
+
+// every connection's events come through here, and go to whoever has the connection at the
+// moment (entry->poll_cb).  In between, the poller is left watching for reads, so starting
+// the next query doesn't cost an epoll_ctl(), and a connection dying while idle is noticed.
+static void uvpg_dispatch_poll(uv_poll_t *poll, int status, int events)
+{
+	UVPGConnEntry *entry = ((uvpg_poller *)poll)->entry;
+	if(entry->flushing && status == 0 && (events & UV_WRITABLE))
+	{
+		// more of a query going out.  Reads still go to the owner meanwhile, the server may
+		// have something to say (an error) before it's taken all of it.
+		if(PQflush(entry->conn) != 1)
+		{
+			entry->flushing = false;
+			entry->pool->setPollEvents(entry, UV_READABLE, entry->poll_cb);
+		}
+		events &= ~UV_WRITABLE;
+		if(events == 0)
+			return;
+	}
+	if(entry->poll_cb)
+		entry->poll_cb(poll, status, events);
+	else
+		entry->pool->idleEvent(entry, status);
+}
+
 
 // Connection poll methods.
 static void uvpg_connection_poll(uv_poll_t *poll);
 
 void uvpg_connection_poll_ready(uv_poll_t *pollhandle, int status, int events)
 {
-	uv_poll_stop(pollhandle);
 	if(status == 0 && (events == UV_READABLE || events == UV_WRITABLE))
 	{
 		uvpg_connection_poll(pollhandle);
 	}
+	else
+	{
+		uvpg_result *result = (uvpg_result *)(pollhandle->data);
+		result->entry->pool->setPollEvents(result->entry, 0, uvpg_connection_poll_ready);
+	}
 }
 
 static void uvpg_connection_poll(uv_poll_t *poll)
@@ -113,19 +339,27 @@ static void uvpg_connection_poll(uv_poll_t *poll)
 	UVPGConnEntry *entry = result->entry;
 	UVPGPool *pool = (UVPGPool *)(result->data);
 	
-	switch(PQconnectPoll(entry->conn))
+	PostgresPollingStatusType pollstatus = entry->resetting ? PQresetPoll(entry->conn) : PQconnectPoll(entry->conn);
+	switch(pollstatus)
 	{
 		case PGRES_POLLING_READING:
 			// wait for socket to be readable
-			uv_poll_start(&(entry->poller), UV_READABLE, uvpg_connection_poll_ready);
+			pool->attachPoller(entry);
+			pool->setPollEvents(entry, UV_READABLE, uvpg_connection_poll_ready);
 			break;
 		case PGRES_POLLING_WRITING:
-			uv_poll_start(&(entry->poller), UV_WRITABLE, uvpg_connection_poll_ready);
+			pool->attachPoller(entry);
+			pool->setPollEvents(entry, UV_WRITABLE, uvpg_connection_poll_ready);
 			break;
 		case PGRES_POLLING_FAILED:
+			entry->poller->data = NULL;
+			pool->releaseResult(result);
 			pool->connectionFailed(entry);
 			break;
 		case PGRES_POLLING_OK:
+			pool->setPollEvents(entry, UV_READABLE, NULL);
+			entry->poller->data = NULL;
+			pool->releaseResult(result);
 			pool->connectionReady(entry);
 			break;
 		default:
@@ -139,6 +373,201 @@ static void uvpg_connection_reset(uv_async_t *async, int status)
 	pool->checkIdleConnections();
 }
 
+static void uvpg_grow_async(uv_async_t *async, int status)
+{
+	UVPGPool *pool = (UVPGPool *)async->data;
+	pool->growConnections();
+}
+
+// submitQuery().
+static void uvpg_submit_async(uv_async_t *async, int status)
+{
+	UVPGPool *pool = (UVPGPool *)async->data;
+	pool->dispatchSubmitted();
+}
+
+static void uvpg_reply_result(PGconn *conn, void *data)
+{
+	// take the result, and the connection goes straight back.
+	uvpg_reply *reply = (uvpg_reply *)data;
+	reply->result = PQgetResult(conn);
+	reply->pool->returnConnection(conn);
+	reply->queue->post(reply);
+}
+
+static void uvpg_reply_failed(PGconn *conn, void *data)
+{
+	uvpg_reply *reply = (uvpg_reply *)data;
+	if(conn != NULL)
+		reply->pool->returnConnection(conn);
+	reply->result = NULL;
+	reply->queue->post(reply);
+}
+
+// sharedQueryAndDo().
+static void uvpg_flight_result(PGconn *conn, void *data)
+{
+	uvpg_flight *flight = (uvpg_flight *)data;
+	PGresult *res = PQgetResult(conn);
+	flight->pool->returnConnection(conn);
+	flight->pool->flightLanded(flight, res);
+}
+
+static void uvpg_flight_failed(PGconn *conn, void *data)
+{
+	uvpg_flight *flight = (uvpg_flight *)data;
+	if(conn != NULL)
+		flight->pool->returnConnection(conn);
+	flight->pool->flightLanded(flight, NULL);
+}
+
+static void uvpg_reply_async(uv_async_t *async, int status)
+{
+	UVPGReplyQueue *queue = (UVPGReplyQueue *)async->data;
+	queue->deliver();
+}
+
+void uvpg_reply_closed(uv_handle_t *handle)
+{
+	delete (UVPGReplyQueue *)handle->data;
+}
+
+// Deadlines.
+static void uvpg_deadline_tick(uv_timer_t *timer, int status)
+{
+	UVPGPool *pool = (UVPGPool *)timer->data;
+	pool->checkDeadlines();
+}
+
+static void uvpg_deadline_expired(uvpg_timer_node *node, void *data)
+{
+	UVPGPool *pool = (UVPGPool *)data;
+	pool->deadlineExpired(node);
+}
+
+// Reconnect backoff and health checks.
+static void uvpg_reconnect_tick(uv_timer_t *timer, int status)
+{
+	UVPGPool *pool = (UVPGPool *)timer->data;
+	pool->reconnect();
+}
+
+static void uvpg_health_tick(uv_timer_t *timer, int status)
+{
+	UVPGPool *pool = (UVPGPool *)timer->data;
+	pool->checkHealth();
+}
+
+static void uvpg_reap_tick(uv_timer_t *timer, int status)
+{
+	UVPGPool *pool = (UVPGPool *)timer->data;
+	pool->reapConnections();
+}
+
+static void uvpg_health_checked(PGconn *conn, void *data)
+{
+	UVPGPool *pool = (UVPGPool *)data;
+	pool->healthChecked(conn, false);
+}
+
+static void uvpg_health_failed(PGconn *conn, void *data)
+{
+	UVPGPool *pool = (UVPGPool *)data;
+	pool->healthChecked(conn, true);
+}
+
+// PQcancel() waits on the server, so it runs on the threadpool.
+struct uvpg_cancel_req
+{
+	uv_work_t work;
+	UVPGConnEntry *entry;
+	PGcancel *cancel;
+};
+
+static void uvpg_cancel_work(uv_work_t *work)
+{
+	uvpg_cancel_req *req = (uvpg_cancel_req *)work->data;
+	char errbuf[256];
+	if(!PQcancel(req->cancel, errbuf, sizeof(errbuf)))
+		printf("Unable to cancel query: %s\n", errbuf);
+}
+
+static void uvpg_cancel_done(uv_work_t *work, int status)
+{
+	uvpg_cancel_req *req = (uvpg_cancel_req *)work->data;
+	PQfreeCancel(req->cancel);
+	req->entry->pool->cancelDone(req->entry);
+	delete req;
+}
+
+//
+// UVPGEntryStack
+//
+
+void UVPGEntryStack::push(UVPGConnEntry *entry)
+{
+	bool expected = false;
+	if(!entry->on_stack[link].compare_exchange_strong(expected, true))
+		return; // never popped since last time, so it's still here.
+	uint64_t oldhead = head.load();
+	uint64_t newhead;
+	do
+	{
+		entry->stack_next[link].store((uint32_t)(oldhead & 0xffffffff));
+		newhead = (((oldhead >> 32) + 1) << 32) | (entry->index + 1);
+	} while(!head.compare_exchange_weak(oldhead, newhead));
+}
+
+UVPGConnEntry *UVPGEntryStack::pop()
+{
+	uint64_t oldhead = head.load();
+	while((oldhead & 0xffffffff) != 0)
+	{
+		UVPGConnEntry *entry = (*entries)[(oldhead & 0xffffffff) - 1];
+		uint64_t newhead = (((oldhead >> 32) + 1) << 32) | entry->stack_next[link].load();
+		if(head.compare_exchange_weak(oldhead, newhead))
+		{
+			entry->on_stack[link].store(false);
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+//
+// UVPGReplyQueue
+//
+
+UVPGReplyQueue::UVPGReplyQueue(uv_loop_t *loop)
+{
+	uv_async_init(loop, &async, uvpg_reply_async);
+	async.data = this;
+}
+
+void UVPGReplyQueue::post(uvpg_reply *reply)
+{
+	if(replies.push(reply))
+		uv_async_send(&async);
+}
+
+void UVPGReplyQueue::deliver()
+{
+	uvpg_reply *reply = replies.popAll();
+	while(reply != NULL)
+	{
+		uvpg_reply *next = reply->queue_next;
+		reply->callback(reply->result, reply->data);
+		delete reply;
+		reply = next;
+	}
+}
+
+void UVPGReplyQueue::close()
+{
+	deliver();
+	uv_close((uv_handle_t *)&async, uvpg_reply_closed);
+}
+
 //
 // UVPGPool
 //
@@ -146,7 +575,14 @@ static void uvpg_connection_reset(uv_async_t *async, int status)
 UVPGPool::UVPGPool(uv_loop_t *in_loop, const char *in_connstring, unsigned in_min_connections, unsigned in_min_free_connections, unsigned in_max_connections, unsigned in_max_free_connections)
 : eventloop(in_loop), connstring(in_connstring),
   min_connections(in_min_connections), max_connections(in_max_connections),
-  min_free_connections(in_min_free_connections), max_free_connections(in_max_free_connections)
+  min_free_connections(in_min_free_connections), max_free_connections(in_max_free_connections),
+  pipeline_depth(0), statement_cache_size(0), statement_hits(0), statement_misses(0),
+  free_entries(&connections, UVPGConnEntry::free_stack), returned_entries(&connections, UVPGConnEntry::return_stack),
+  session_reset_query(NULL), available_count(0), connecting_count(0), open_count(0), pending_count(0),
+  backoff_base_ms(UVPG_BACKOFF_BASE_MS), backoff_max_ms(UVPG_BACKOFF_MAX_MS), connect_failures(0), reconnect_at(0),
+  breaker_failures(UVPG_BREAKER_FAILURES), breaker_open(false), health_interval_ms(UVPG_HEALTH_INTERVAL_MS),
+  idle_timeout_ms(UVPG_IDLE_TIMEOUT_MS), max_lifetime_ms(0),
+  ready_cb(NULL), ready_data(NULL), ready(false)
 {
 	// some sanity checks for input.
 	if(min_connections <= 0)
@@ -158,17 +594,42 @@ UVPGPool::UVPGPool(uv_loop_t *in_loop, const char *in_connstring, unsigned in_mi
 	if(max_free_connections < min_connections)
 		max_free_connections = min_connections + 1;
 	
-	createNewConnections(min_connections);
+	// entries are looked up by index from other threads, so the vector can't move under them.
+	connections.reserve(max_connections);
 	uv_async_init(eventloop, &reset_msg, uvpg_connection_reset);
 	reset_msg.data = this;
+	uv_async_init(eventloop, &submit_msg, uvpg_submit_async);
+	submit_msg.data = this;
+	uv_async_init(eventloop, &grow_msg, uvpg_grow_async);
+	grow_msg.data = this;
+	uv_timer_init(eventloop, &deadline_timer);
+	deadline_timer.data = this;
+	// a connection can fail straight out of PQconnectStart, which starts the backoff.
+	uv_timer_init(eventloop, &reconnect_timer);
+	reconnect_timer.data = this;
+	uv_timer_init(eventloop, &health_timer);
+	health_timer.data = this;
+	setHealthCheckInterval(health_interval_ms);
+	uv_timer_init(eventloop, &reap_timer);
+	reap_timer.data = this;
+	uv_timer_start(&reap_timer, uvpg_reap_tick, UVPG_REAP_INTERVAL_MS, UVPG_REAP_INTERVAL_MS);
+	uv_unref((uv_handle_t *)&reap_timer);
+	createNewConnections(min_connections);
 }
 UVPGPool::~UVPGPool()
 {
+	uv_timer_stop(&reconnect_timer);
+	uv_timer_stop(&health_timer);
+	uv_timer_stop(&reap_timer);
 	size_t count = connections.size();
 	for(int ix = 0; ix < count; ++ix)
 	{
 		disconnect(connections[ix]);
 	}
+	for(size_t ix = 0; ix < free_results.size(); ++ix)
+		delete free_results[ix];
+	for(size_t ix = 0; ix < free_queries.size(); ++ix)
+		delete free_queries[ix];
 }
 
 void UVPGPool::watchConnectionState(UVPGConnEntry *entry)
@@ -179,9 +640,10 @@ void UVPGPool::watchConnectionState(UVPGConnEntry *entry)
 	uvpg_result *resstruct = newResultStruct();
 	resstruct->entry = entry;
 	resstruct->data	= this;
-	entry->poller.data = resstruct;
-	// now that we have our structure, poll the connection with PQconnectPoll.
-	uvpg_connection_poll((uv_poll_t *)&entry->poller);
+	attachPoller(entry);
+	entry->poller->data = resstruct;
+	// now that we have our structure, poll the connection with PQconnectPoll (or PQresetPoll).
+	uvpg_connection_poll(entry->poller);
 }
 
 void UVPGPool::createNewConnections(unsigned newcount)
@@ -191,25 +653,35 @@ void UVPGPool::createNewConnections(unsigned newcount)
 	if(newcount == 0)
 		newcount = min_free_connections;
 	
+	// still waiting out a failed attempt, the reconnect timer tries again.
+	if(backingOff())
+		return;
+	
 	size_t num_entries = connections.size();
 	unsigned created_count = 0;
-	for(size_t jx = 0; created_count < newcount && jx < num_entries; ++jx)
+	for(size_t jx = 0; created_count < newcount && jx < num_entries && !backingOff(); ++jx)
 	{
 		if(atomicCAS(&(connections[jx]->status), &(ConnStatus::cs_invalid), ConnStatus::cs_connecting))
 		{
 			created_count++;
+			open_count++;
+			connecting_count++;
 			connections[jx]->conn = PQconnectStart(connstring);
 			if(connections[jx]->conn)
 			{
+				attachConn(connections[jx]);
 				if(PQstatus(connections[jx]->conn) == CONNECTION_BAD)
 				{
 					printf("Connection to database failed (%s): %s\n", connstring, PQerrorMessage(connections[jx]->conn));
+					connectionFailed(connections[jx]);
 				}
 				else
 				{
 					watchConnectionState(connections[jx]);
 				}
 			}
+			else
+				connectionFailed(connections[jx]);
 		}
 	}
 	// verify that we're not pas our max connection size.
@@ -220,212 +692,579 @@ void UVPGPool::createNewConnections(unsigned newcount)
 	
 	// now that we've grabbed all the inactive connections we can, create new ones until
 	// we have enough free connections.
-	for( ; created_count < newcount; ++created_count)
+	for( ; created_count < newcount && !backingOff(); ++created_count)
 	{
 		UVPGConnEntry *entry = new UVPGConnEntry;
+		entry->pool = this;
+		entry->index = (uint32_t)connections.size();
 		entry->conn = PQconnectStart(connstring);
 		entry->status.store(ConnStatus::cs_connecting);
+		open_count++;
+		connecting_count++;
 		connections.push_back(entry);
 		if(entry->conn)
 		{
-			uv_poll_init_socket(eventloop, &(entry->poller), PQsocket(entry->conn));
+			attachConn(entry);
 			if(PQstatus(entry->conn) == CONNECTION_BAD)
 			{
 				printf("Connection to database failed (%s): %s\n", connstring, PQerrorMessage(entry->conn));
+				connectionFailed(entry);
 			}
 			else
 			{
 				watchConnectionState(entry);
 			}
 		}
+		else
+			connectionFailed(entry);
 	}
 }
 
 void UVPGPool::connectionFailed(UVPGConnEntry *entry)
 {
-	// connection failed, so just remove it, and ... do we worry?
-	if(atomicCAS(&(entry->status), &(ConnStatus::cs_connecting), ConnStatus::cs_disconnecting))
+	// connection failed, so just remove it, and back off before trying again.
+	if(!atomicCAS(&(entry->status), &(ConnStatus::cs_connecting), ConnStatus::cs_disconnecting))
+		return;
+	connecting_count--;
+	entry->resetting = false;
+	releasePoller(entry);
+	PQfinish(entry->conn);
+	entry->conn = NULL;
+	entry->statements.clear();
+	open_count--;
+	entry->status.store(ConnStatus::cs_invalid);
+	
+	// everything failing at once (the server is down) counts as one failure, not one each.
+	if(uv_is_active((uv_handle_t *)&reconnect_timer))
+		return;
+	connect_failures++;
+	uint64_t delay = backoff_max_ms;
+	if(connect_failures <= 32 && ((uint64_t)backoff_base_ms << (connect_failures - 1)) < backoff_max_ms)
+		delay = (uint64_t)backoff_base_ms << (connect_failures - 1);
+	// jitter, so a lot of pools don't all come back at the same moment.
+	delay = delay / 2 + rand() % (delay / 2 + 1);
+	reconnect_at.store((uint64_t)uv_now(eventloop) + delay);
+	uv_timer_start(&reconnect_timer, uvpg_reconnect_tick, delay, 0);
+	
+	if(breaker_failures > 0 && connect_failures >= breaker_failures && !breaker_open && available_count.load() == 0)
 	{
-		PQfinish(entry->conn);
-		entry->conn = NULL;
-		entry->status.store(ConnStatus::cs_invalid);
+		printf("Unable to connect to database (%s) after %u attempts, failing queries until it's back.\n", connstring, connect_failures);
+		breaker_open = true;
+		failQueued();
 	}
 }
 void UVPGPool::connectionReady(UVPGConnEntry *entry)
 {
 	// connection has become ready, move it to our available connections queue.
-	atomicCAS(&(entry->status), &(ConnStatus::cs_connecting), ConnStatus::cs_available);
+	entry->resetting = false;
+	connect_failures = 0;
+	breaker_open = false;
+	// sends never wait on the socket, whatever doesn't fit goes out as it becomes writable.
+	PQsetnonblocking(entry->conn, 1);
+	entry->flushing = false;
+	entry->connected_at = entry->last_used = (uint64_t)uv_now(eventloop);
+	if(makeAvailable(entry, ConnStatus::cs_connecting))
+		connecting_count--;
+	checkReady();
 	checkQueuedRequests();
 }
-void UVPGPool::checkIdleConnections()
+bool UVPGPool::backingOff()
 {
-	for(size_t ix = 0; ix < connections.size(); ++ix)
-	{
-		atomicCAS(&(connections[ix]->status), &(ConnStatus::cs_idle_ready), ConnStatus::cs_available);
-	}
-	checkQueuedRequests();
+	uint64_t until = reconnect_at.load();
+	return until != 0 && until > (uint64_t)uv_now(eventloop);
 }
-
-void UVPGPool::disconnect(PGconn *conn)
+void UVPGPool::reconnect()
 {
-	UVPGConnEntry *entry = findConnEntry(conn);
-	if(entry == NULL)
+	reconnect_at.store(0);
+	// back up to the minimum, plus whatever the queue needs.
+	if(open_count.load() < min_connections)
+		createNewConnections(min_connections - open_count.load());
+	else if(!pendingQueries.empty())
+		createNewConnections();
+}
+void UVPGPool::growConnections()
+{
+	// reconnect entries that have gone, or make more if we're short on free ones and there's room.
+	unsigned free_count = available_count.load() + connecting_count.load();
+	if(connections.size() > open_count.load() ||
+	   (free_count < min_free_connections && open_count.load() < max_connections))
+		createNewConnections();
+}
+void UVPGPool::checkReady()
+{
+	if(ready || open_count.load() - connecting_count.load() < min_connections)
 		return;
-	disconnect(entry);
+	ready = true;
+	if(ready_cb)
+		ready_cb(this, ready_data);
 }
-void UVPGPool::disconnect(UVPGConnEntry *entry)
+void UVPGPool::setReconnectBackoff(unsigned base_ms, unsigned max_ms)
 {
-	bool set_disconnect = false;
-	if(atomicCAS(&(entry->status), &(ConnStatus::cs_connecting), ConnStatus::cs_disconnecting))
+	backoff_base_ms = base_ms > 0 ? base_ms : 1;
+	backoff_max_ms = max_ms > backoff_base_ms ? max_ms : backoff_base_ms;
+}
+void UVPGPool::setReadyCallback(uvpg_pool_cb callback, void *data)
+{
+	ready_cb = callback;
+	ready_data = data;
+	if(ready && ready_cb)
+		ready_cb(this, ready_data);
+}
+void UVPGPool::setHealthCheckInterval(unsigned ms)
+{
+	health_interval_ms = ms;
+	if(ms == 0)
 	{
-		set_disconnect = true;
+		uv_timer_stop(&health_timer);
+		return;
 	}
-	if(atomicCAS(&(entry->status), &(ConnStatus::cs_available), ConnStatus::cs_disconnecting))
+	uv_timer_start(&health_timer, uvpg_health_tick, ms, ms);
+	// nothing to do but this, don't keep the loop running just for it.
+	uv_unref((uv_handle_t *)&health_timer);
+}
+void UVPGPool::checkHealth()
+{
+	// ping each connection idle since the last check with an empty query; whatever doesn't
+	// answer gets reset.
+	uint64_t now = (uint64_t)uv_now(eventloop);
+	size_t count = connections.size();
+	for(size_t ix = 0; ix < count; ++ix)
 	{
-		set_disconnect = true;
+		UVPGConnEntry *entry = connections[ix];
+		if(now - entry->last_used < health_interval_ms)
+			continue;
+		if(!atomicCAS(&(entry->status), &(ConnStatus::cs_available), ConnStatus::cs_busy))
+			continue;
+		available_count--;
+		entry->generation++;
+		if(!PQsendQuery(entry->conn, "") || !flushEntry(entry))
+		{
+			returnEntry(entry);
+			continue;
+		}
+		uvpg_result *result = newResultStruct();
+		result->entry = entry;
+		result->data = this;
+		executeOnResult(result, uvpg_health_checked, uvpg_health_failed);
 	}
-	if(atomicCAS(&(entry->status), &(ConnStatus::cs_busy), ConnStatus::cs_disconnecting))
+}
+void UVPGPool::healthChecked(PGconn *conn, bool failed)
+{
+	UVPGConnEntry *entry = findConnEntry(conn);
+	bool healthy = !failed;
+	PGresult *res;
+	while(healthy && PQisBusy(conn) == 0 && (res = PQgetResult(conn)) != NULL)
 	{
-		set_disconnect = true;
+		if(PQresultStatus(res) != PGRES_EMPTY_QUERY)
+			healthy = false;
+		PQclear(res);
 	}
-	if(set_disconnect && entry->status.load() == ConnStatus::cs_disconnecting)
+	if(healthy && PQisBusy(conn) == 0 && PQtransactionStatus(conn) == PQTRANS_IDLE)
 	{
-		// since once a status is set to disconnecting, that thread will be responsible for cleanup
-		// and invalidation, this operation is fine here, as we set disconnect on this entry
-		PQfinish(entry->conn);
-		entry->conn	= NULL;
-		entry->status.store(ConnStatus::cs_invalid);
-		uv_poll_stop(&(entry->poller));
+		// straight back, no need to validate it.
+		if(makeAvailable(entry, ConnStatus::cs_busy))
+			checkQueuedRequests();
+		return;
 	}
+	// validation sorts it out, or resets it.
+	returnEntry(entry);
 }
-UVPGConnEntry *UVPGPool::findConnEntry(PGconn *conn)
+void UVPGPool::checkIdleConnections()
 {
-	if(!conn)
-		return NULL;
-	size_t count = connections.size();
-	for(size_t ix = 0; ix < count; ++ix)
+	// everything returned since we last looked.
+	UVPGConnEntry *entry;
+	while((entry = returned_entries.pop()) != NULL)
 	{
-		if(connections[ix]->conn == conn)
-			return connections[ix];
+		entry->validate_step = UVPGConnEntry::vs_none;
+		uvpg_result *resstruct = newResultStruct();
+		resstruct->entry = entry;
+		resstruct->data = this;
+		// returned before its result came in; nobody's waiting on that anymore.
+		setPollEvents(entry, UV_READABLE, NULL);
+		if(entry->poller->data && PQisBusy(entry->conn))
+			cancelQuery(entry);
+		releaseResult((uvpg_result *)entry->poller->data);
+		entry->poller->data = resstruct;
+		validateConnection(entry);
 	}
-	return NULL;
+	checkQueuedRequests();
 }
 
-// routines for getting a connection, and getting rid of it (because you're done).
-PGconn *UVPGPool::getFreeConn(bool add_more)
+void UVPGPool::validateConnection(UVPGConnEntry *entry)
 {
-	// grab the first available connection
-	// shove it onto the busy list.
-	PGconn *nextconn = NULL;
-	size_t disconnectedCount = 0;
-	size_t count = connections.size();
-	for(unsigned ix = 0; ix < count; ++ix)
+	// make sure a returned connection isn't in the middle of anything, without ever
+	// waiting on the server: each step that needs a reply comes back through here.
+	PGconn *conn = entry->conn;
+	if(PQconsumeInput(conn) == 0)
 	{
-		if(atomicCAS(&(connections[ix]->status), &(ConnStatus::cs_available), ConnStatus::cs_busy))
-		{
-			nextconn = connections[ix]->conn;
+		resetConnection(entry);
+		return;
+	}
+	while(PQisBusy(conn) == 0)
+	{
+		PGresult *res = PQgetResult(conn);
+		if(res == NULL)
 			break;
+		ExecStatusType resstatus = PQresultStatus(res);
+		PQclear(res);
+		if(resstatus == PGRES_COPY_IN || resstatus == PGRES_COPY_OUT || resstatus == PGRES_COPY_BOTH)
+		{
+			// left in the middle of a COPY, not worth trying to talk it out of that.
+			resetConnection(entry);
+			return;
 		}
-		if(connections[ix]->status == ConnStatus::cs_invalid)
-			disconnectedCount++;
 	}
-	if(nextconn == NULL)
+	if(PQisBusy(conn))
 	{
-		// no available connections.  Have the system create some
-		// if there are disconnected entries.
-		if(disconnectedCount > 0)
-			createNewConnections();
-		return NULL;
+		// still results to come, wait for them.
+		setPollEvents(entry, UV_READABLE, uvpg_validate_poll);
+		return;
 	}
 	
-	// check connection status, make sure it hasn't gone bad.
-	switch(PQstatus(nextconn))
-	{
-		case CONNECTION_BAD:
-			// end this connection, and get a new one.
-			PQfinish(nextconn);
-			createNewConnections();
-			nextconn = getFreeConn(add_more);
+	switch(PQtransactionStatus(conn))
+	{
+		case PQTRANS_IDLE:
+			if(session_reset_query && entry->validate_step != UVPGConnEntry::vs_session_reset)
+			{
+				entry->validate_step = UVPGConnEntry::vs_session_reset;
+				entry->statements.clear();
+				if(!PQsendQuery(conn, session_reset_query) || !flushEntry(entry))
+					resetConnection(entry);
+				else
+					setPollEvents(entry, UV_READABLE, uvpg_validate_poll);
+				return;
+			}
+			// this one is idle (and clean).
+			setPollEvents(entry, UV_READABLE, NULL);
+			if(entry->cancels_pending > 0)
+			{
+				// a cancel still on its way could hit the next user's query. cancelDone() comes back here.
+				entry->cancel_wait = true;
+				return;
+			}
+			releaseResult((uvpg_result *)entry->poller->data);
+			entry->poller->data = NULL;
+			entry->last_used = (uint64_t)uv_now(eventloop);
+			// validation may have finished long after checkIdleConnections(), so look at the queue here.
+			if(makeAvailable(entry, ConnStatus::cs_validating))
+				checkQueuedRequests();
+			return;
+		case PQTRANS_INTRANS:
+		case PQTRANS_INERROR:
+			if(entry->validate_step == UVPGConnEntry::vs_none)
+			{
+				entry->validate_step = UVPGConnEntry::vs_rollback;
+				if(!PQsendQuery(conn, "ROLLBACK") || !flushEntry(entry))
+					resetConnection(entry);
+				else
+					setPollEvents(entry, UV_READABLE, uvpg_validate_poll);
+				return;
+			}
+			// a ROLLBACK (or the reset query) left us in a transaction, don't trust it.
+			resetConnection(entry);
+			return;
 		default:
-			break;
+			// PQTRANS_UNKNOWN, the connection is bad.
+			resetConnection(entry);
+			return;
+	}
+}
+
+void UVPGPool::resetConnection(UVPGConnEntry *entry)
+{
+	// the session is broken, reconnect it, driven by the loop like any new connection.
+	if(entry->poller)
+	{
+		// the socket is about to be replaced.
+		setPollEvents(entry, 0, NULL);
+		releaseResult((uvpg_result *)entry->poller->data);
+		entry->poller->data = NULL;
+	}
+	entry->statements.clear();
+	if(!atomicCAS(&(entry->status), &(ConnStatus::cs_validating), ConnStatus::cs_connecting))
+		return;
+	connecting_count++;
+	if(PQresetStart(entry->conn) == 0)
+	{
+		connectionFailed(entry);
+		return;
+	}
+	entry->resetting = true;
+	watchConnectionState(entry);
+}
+
+void UVPGPool::reapConnections()
+{
+	// see if we need to drop any connections: idle too long, more spare ones than we want,
+	// or just too old.  Starting from the back of the vector, as those are the least likely
+	// to be used.
+	uint64_t now = (uint64_t)uv_now(eventloop);
+	bool rotated = false;
+	for(size_t ix = connections.size(); ix > 0; --ix)
+	{
+		UVPGConnEntry *entry = connections[ix-1];
+		if(entry->status.load() != ConnStatus::cs_available)
+			continue;
+		uint64_t idle = now - entry->last_used;
+		bool expired = max_lifetime_ms > 0 && !rotated && now - entry->connected_at >= max_lifetime_ms;
+		bool surplus = open_count.load() > min_connections &&
+			((idle_timeout_ms > 0 && idle >= idle_timeout_ms) ||
+			 (available_count.load() > max_free_connections && idle >= UVPG_REAP_INTERVAL_MS));
+		if(!expired && !surplus)
+			continue;
+		if(!atomicCAS(&(entry->status), &(ConnStatus::cs_available), ConnStatus::cs_busy))
+			continue;
+		available_count--;
+		disconnect(entry);
+		if(expired)
+			rotated = true;
+	}
+	// a rotated connection (or one lost some other way) is replaced right away.
+	if(open_count.load() < min_connections)
+		createNewConnections(min_connections - open_count.load());
+}
+
+bool UVPGPool::makeAvailable(UVPGConnEntry *entry, uint8_t from_status)
+{
+	// status first, so that anyone popping it off the stack can take it.
+	if(!atomicCAS(&(entry->status), &from_status, ConnStatus::cs_available))
+		return false;
+	available_count++;
+	free_entries.push(entry);
+	return true;
+}
+UVPGConnEntry *UVPGPool::popFreeEntry()
+{
+	// most recently returned first, so busy periods keep reusing the same (warm) connections
+	// and the rest sit idle long enough to be trimmed.
+	UVPGConnEntry *entry;
+	while((entry = free_entries.pop()) != NULL)
+	{
+		if(atomicCAS(&(entry->status), &(ConnStatus::cs_available), ConnStatus::cs_busy))
+		{
+			available_count--;
+			return entry;
+		}
+		// it was taken some other way (disconnect, trimming), keep looking.
+	}
+	return NULL;
+}
+
+void UVPGPool::attachPoller(UVPGConnEntry *entry)
+{
+	// libpq may hand us a new socket (PQresetStart, or another host during PQconnectPoll),
+	// and a uv_poll_t can't be pointed at a different one; replace it when that happens.
+	int fd = PQsocket(entry->conn);
+	if(entry->poller && entry->poller_fd == fd)
+		return;
+	void *data = entry->poller ? entry->poller->data : NULL;
+	releasePoller(entry);
+	uvpg_poller *poller = new uvpg_poller;
+	poller->entry = entry;
+	entry->poller = &poller->handle;
+	uv_poll_init_socket(eventloop, entry->poller, fd);
+	entry->poller->data = data;
+	entry->poller_fd = fd;
+}
+void UVPGPool::releasePoller(UVPGConnEntry *entry)
+{
+	if(entry->poller == NULL)
+		return;
+	uv_poll_stop(entry->poller);
+	uv_close((uv_handle_t *)entry->poller, uvpg_free_poller);
+	entry->poller = NULL;
+	entry->poller_fd = -1;
+	entry->poll_events = 0;
+	entry->poll_cb = NULL;
+	entry->flushing = false;
+}
+void UVPGPool::setPollEvents(UVPGConnEntry *entry, int events, uv_poll_cb callback)
+{
+	// handing the connection to its next owner (or back to idle) is just the callback; the
+	// poller itself is only touched when the events change.
+	entry->poll_cb = callback;
+	if(events != 0 && entry->flushing)
+		events |= UV_WRITABLE;
+	if(events == entry->poll_events)
+		return;
+	entry->poll_events = events;
+	if(events == 0)
+		uv_poll_stop(entry->poller);
+	else
+		uv_poll_start(entry->poller, events, uvpg_dispatch_poll);
+}
+bool UVPGPool::flushEntry(UVPGConnEntry *entry)
+{
+	// connections are non-blocking, so a send can leave part of the query in libpq's buffer
+	// (a big parameter, a full socket).  The rest goes out as the socket becomes writable,
+	// through uvpg_dispatch_poll; setPollEvents() adds UV_WRITABLE until it's all gone.
+	int res = PQflush(entry->conn);
+	entry->flushing = (res == 1);
+	return res >= 0;
+}
+void UVPGPool::idleEvent(UVPGConnEntry *entry, int status)
+{
+	// nobody's waiting on this connection.  If it's in the pool, read whatever it was: a notice
+	// or notification is dropped, and an error or EOF means it died, which validation sorts out.
+	if(!atomicCAS(&(entry->status), &(ConnStatus::cs_available), ConnStatus::cs_busy))
+	{
+		// it's someone's (maybe off the loop), so leave the socket to them until it comes back.
+		setPollEvents(entry, 0, NULL);
+		return;
+	}
+	available_count--;
+	entry->generation++;
+	if(status == 0 && PQconsumeInput(entry->conn) != 0)
+	{
+		PGnotify *notify;
+		while((notify = PQnotifies(entry->conn)) != NULL)
+			PQfreemem(notify);
+		makeAvailable(entry, ConnStatus::cs_busy);
+		return;
+	}
+	returnEntry(entry);
+}
+
+void UVPGPool::disconnect(PGconn *conn)
+{
+	UVPGConnEntry *entry = findConnEntry(conn);
+	if(entry == NULL)
+		return;
+	disconnect(entry);
+}
+void UVPGPool::disconnect(UVPGConnEntry *entry)
+{
+	bool set_disconnect = false;
+	if(atomicCAS(&(entry->status), &(ConnStatus::cs_connecting), ConnStatus::cs_disconnecting))
+	{
+		connecting_count--;
+		set_disconnect = true;
+	}
+	if(atomicCAS(&(entry->status), &(ConnStatus::cs_available), ConnStatus::cs_disconnecting))
+	{
+		available_count--;
+		set_disconnect = true;
+	}
+	if(atomicCAS(&(entry->status), &(ConnStatus::cs_busy), ConnStatus::cs_disconnecting))
+	{
+		set_disconnect = true;
+	}
+	if(atomicCAS(&(entry->status), &(ConnStatus::cs_pipelined), ConnStatus::cs_disconnecting))
+	{
+		set_disconnect = true;
+	}
+	if(set_disconnect && entry->status.load() == ConnStatus::cs_disconnecting)
+	{
+		// since once a status is set to disconnecting, that thread will be responsible for cleanup
+		// and invalidation, this operation is fine here, as we set disconnect on this entry
+		releasePoller(entry);
+		PQfinish(entry->conn);
+		entry->conn	= NULL;
+		entry->statements.clear();
+		open_count--;
+		entry->status.store(ConnStatus::cs_invalid);
+	}
+}
+void UVPGPool::attachConn(UVPGConnEntry *entry)
+{
+	PQregisterEventProc(entry->conn, uvpg_conn_event, "uvpgpool", NULL);
+	PQsetInstanceData(entry->conn, uvpg_conn_event, entry);
+}
+UVPGConnEntry *UVPGPool::findConnEntry(PGconn *conn)
+{
+	if(!conn)
+		return NULL;
+	return (UVPGConnEntry *)PQinstanceData(conn, uvpg_conn_event);
+}
+UVPGPool *UVPGPool::poolOf(PGconn *conn)
+{
+	if(!conn)
+		return NULL;
+	UVPGConnEntry *entry = (UVPGConnEntry *)PQinstanceData(conn, uvpg_conn_event);
+	return entry ? entry->pool : NULL;
+}
+UVPGConnEntry *UVPGPool::findConnEntry(uvpg_conn_handle handle)
+{
+	uint32_t index = (uint32_t)(handle & 0xffffffff);
+	uint32_t generation = (uint32_t)(handle >> 32);
+	if(handle == UVPG_INVALID_HANDLE || index >= connections.size())
+		return NULL;
+	UVPGConnEntry *entry = connections[index];
+	if(entry->generation.load() != generation)
+		return NULL; // stale, it's been returned since.
+	return entry;
+}
+
+// routines for getting a connection, and getting rid of it (because you're done).
+UVPGConnEntry *UVPGPool::getFreeEntry(bool add_more)
+{
+	// grab the most recently returned available connection
+	// (it's marked busy on the way off the free stack).
+	UVPGConnEntry *nextentry = popFreeEntry();
+	if(nextentry == NULL)
+	{
+		// no available connections.  Have the loop create some (this may not be the
+		// loop's thread, and making connections touches libuv and the connections vector).
+		uv_async_send(&grow_msg);
+		return NULL;
 	}
 	
+	// no PQstatus() check here: it only changes when libpq reads from the socket, which
+	// the health checks do for idle connections.
+	nextentry->generation++;
+	
 	// see if we need to create a new connection, if we're full.
 	if(add_more)
 	{
-		size_t ccount = connections.size();
-		unsigned free_count = 0;
-		for(size_t ix = 0; ix < ccount; ++ix)
-		{
-			int connstatus = connections[ix]->status.load();
-			if(connstatus == ConnStatus::cs_available ||
-			   connstatus == ConnStatus::cs_connecting)
-				free_count++;
-		}
+		unsigned free_count = available_count.load() + connecting_count.load();
 		// create them only if there's room.
-		if(free_count < min_free_connections && connections.size() < max_connections)
-		{
-			createNewConnections();
-		}
+		if(free_count < min_free_connections && open_count.load() < max_connections)
+			uv_async_send(&grow_msg);
 	}
 	
-	return nextconn;
+	return nextentry;
+}
+uvpg_conn_handle UVPGPool::acquireConn(bool add_more)
+{
+	UVPGConnEntry *entry = getFreeEntry(add_more);
+	return entry ? uvpg_make_handle(entry) : UVPG_INVALID_HANDLE;
+}
+PGconn *UVPGPool::handleConn(uvpg_conn_handle handle)
+{
+	UVPGConnEntry *entry = findConnEntry(handle);
+	return entry ? entry->conn : NULL;
+}
+PGconn *UVPGPool::getFreeConn(bool add_more)
+{
+	UVPGConnEntry *entry = getFreeEntry(add_more);
+	return entry ? entry->conn : NULL;
+}
+void UVPGPool::returnConnection(uvpg_conn_handle handle)
+{
+	UVPGConnEntry *entry = findConnEntry(handle);
+	if(entry == NULL)
+	{
+		printf("Stale or invalid connection handle returned to pool.\n");
+		return;
+	}
+	returnEntry(entry);
 }
 void UVPGPool::returnConnection(PGconn *in_conn)
 {
-	// remove connection from busy list, add to available.
-	// alternative: call PQresetStart, and add to "connecting" list.
 	UVPGConnEntry *entry = findConnEntry(in_conn);
 	if(entry == NULL)
 		return;
+	returnEntry(entry);
+}
+void UVPGPool::returnEntry(UVPGConnEntry *entry)
+{
+	// remove connection from busy list; the loop validates it and makes it available again.
+	// nothing here touches libuv (other than the async) or the server, so any thread can do this.
 	if(atomicCAS(&(entry->status), &(ConnStatus::cs_busy), ConnStatus::cs_validating))
 	{
-		uv_poll_stop(&(entry->poller)); // just in case it's in the middle of anything.
-		
-		// clean up the connection
-		PGresult *res = PQgetResult(entry->conn);
-		while(res != NULL) {
-			PQclear(res);
-			res = PQgetResult(entry->conn);
-		}
-		entry->poller.data = NULL;
-		
-		// check the PQstatus to make sure it's not actually in the middle of anything
-		// and that we haven't been lied to.  If we've been lied to, set to connecting & reset.
-		switch(PQtransactionStatus(entry->conn))
-		{
-			case PQTRANS_IDLE:
-				// this one is idle.
-				entry->status.store(ConnStatus::cs_idle_ready);
-				uv_async_send(&reset_msg);
-				break;
-			default:
-				PQreset(entry->conn);
-				entry->status.store(ConnStatus::cs_connecting);
-				watchConnectionState(entry);
-		}
-	}
-	// see if we need to drop any connections, if we have too many.
-	size_t ccount = connections.size();
-	unsigned free_count = 0;
-	for(size_t ix = 0; ix < ccount; ++ix)
-	{
-		int connstatus = connections[ix]->status.load();
-		if(connstatus == ConnStatus::cs_available)
-			free_count++;
-	}
-	if(free_count > max_free_connections && connections.size() > min_connections)
-	{
-		// Closing a connection here.  preferably, the last in the vector,
-		// as it's the least likely to be used.
-		for(size_t ix = connections.size(); ix > 0; --ix)
-		{
-			if(atomicCAS(&(connections[ix-1]->status), &(ConnStatus::cs_available), ConnStatus::cs_busy))
-			{
-				disconnect(connections[ix-1]);
-				break;
-			}
-		}
+		entry->generation++;
+		returned_entries.push(entry);
+		uv_async_send(&reset_msg);
 	}
 }
 
@@ -436,9 +1275,11 @@ void UVPGPool::executeOnResult(uvpg_result *result, uvpg_result_cb callback, uvp
 	result->result_cb = callback;
 	result->failure_cb = failure_cb;
 	// don't really like doing this circular set of pointers, but... sort of need it. (refactor, maybe?)
-	result->entry->poller.data = result;
+	result->entry->poller->data = result;
 	
-	uv_poll_start(&(result->entry->poller), UV_READABLE, uvpg_read_result);
+	// also whatever the caller sent themselves.  If that fails, the read will too.
+	flushEntry(result->entry);
+	setPollEvents(result->entry, UV_READABLE, uvpg_read_result);
 }
 void UVPGPool::executeOnResult(PGconn *in_conn, uvpg_result_cb callback, uvpg_result_cb failure_cb)
 {
@@ -454,30 +1295,687 @@ void UVPGPool::executeOnResult(PGconn *in_conn, void *data, uvpg_result_cb callb
 	
 	executeOnResult(result, callback, failure_cb);
 }
+void UVPGPool::executeOnResult(uvpg_conn_handle handle, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb)
+{
+	UVPGConnEntry *entry = findConnEntry(handle);
+	if(entry == NULL)
+	{
+		printf("Stale or invalid connection handle passed to executeOnResult.\n");
+		return;
+	}
+	uvpg_result *result = newResultStruct();
+	result->entry = entry;
+	result->data	= data;
+	
+	executeOnResult(result, callback, failure_cb);
+}
+
+void UVPGPool::setPipelineDepth(unsigned depth)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	pipeline_depth = depth > 1 ? depth : 0;
+#else
+	if(depth > 1)
+		printf("Pipeline mode requires libpq 14 or newer, ignoring.\n");
+#endif
+}
+
+bool UVPGPool::dispatchQuery(const char *query, const char *statement, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb, uint64_t expires, uint64_t started)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	if(pipeline_depth > 0)
+	{
+		UVPGConnEntry *entry = getPipelinedConn();
+		if(entry == NULL)
+			return false;
+		
+		uvpg_result *result = newResultStruct();
+		result->entry = entry;
+		result->data = data;
+		result->result_cb = callback;
+		result->failure_cb = failure_cb;
+		result->pipeline_stage = uvpg_result::ps_result;
+		entry->inflight.push_back(result);
+		if(expires)
+			armDeadline(&result->deadline, expires);
+		querySent(result, started, true);
+		
+		// one sync per query, so that an error only aborts the query which caused it.
+		if(!sendQuery(entry, result, query, statement, params, resultFormat) || !PQpipelineSync(entry->conn) || !flushEntry(entry))
+		{
+			pipelineFailed(entry);
+			return true;
+		}
+		setPollEvents(entry, UV_READABLE, uvpg_read_pipeline);
+		return true;
+	}
+#endif
+	
+	UVPGConnEntry *entry = getFreeEntry(true);
+	if(entry == NULL)
+		return false;
+	uvpg_result *result = newResultStruct();
+	result->entry = entry;
+	result->data = data;
+	querySent(result, started, true);
+	if(!sendQuery(result->entry, result, query, statement, params, resultFormat))
+	{
+		result->result_cb = callback;
+		result->failure_cb = failure_cb;
+		failResult(result);
+		return true;
+	}
+	executeOnResult(result, callback, failure_cb);
+	if(expires)
+		armDeadline(&result->deadline, expires);
+	return true;
+}
 
-void UVPGPool::sendQueryAndDo(const char *query, UVPGParams *params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb)
+bool UVPGPool::sendQuery(UVPGConnEntry *entry, uvpg_result *result, const char *query, const char *statement, const uvpg_param_arrays &params, int resultFormat)
 {
-	// try to get a free connection
-	PGconn *conn = getFreeConn();
-	// if success, do PQsendQueryParams,
-	if(conn)
+	PGconn *conn = entry->conn;
+	if(statement_cache_size == 0)
+		return PQsendQueryParams(conn, query, params.count, params.oids, params.values,
+								 params.lengths, params.formats, resultFormat) != 0;
+	
+	const char *key = statement ? statement : query;
+	const char *name = entry->statements.find(key);
+	if(name)
 	{
-		PQsendQueryParams(conn, query, (int)params->size(), params->oids(), params->values(), params->lengths(), params->formats(), resultFormat);
-		executeOnResult(conn, data, callback, failure_cb);
+		statement_hits++;
+		return PQsendQueryPrepared(conn, name, params.count, params.values,
+								   params.lengths, params.formats, resultFormat) != 0;
+	}
+	statement_misses++;
+	name = entry->statements.add(key, statement_cache_size);
+	result->prepared_key = key;
+	
+#ifdef LIBPQ_HAS_PIPELINING
+	if(PQpipelineStatus(conn) == PQ_PIPELINE_ON)
+	{
+		// everything can go out back to back, the extra results get skipped on the way in.
+#ifdef LIBPQ_HAS_CLOSE_PREPARED
+		while(!entry->statements.evicted.empty())
+		{
+			if(!PQsendClosePrepared(conn, entry->statements.evicted.back().c_str()))
+				return false;
+			entry->statements.evicted.pop_back();
+			result->pipeline_skip++;
+		}
+#else
+		// without Close, DEALLOCATE them, behind a sync of their own so that one failing
+		// doesn't abort the prepare and the query.
+		if(!entry->statements.evicted.empty())
+		{
+			std::string deallocate;
+			while(!entry->statements.evicted.empty())
+			{
+				deallocate = "DEALLOCATE ";
+				deallocate += entry->statements.evicted.back();
+				if(!PQsendQueryParams(conn, deallocate.c_str(), 0, NULL, NULL, NULL, NULL, 0))
+					return false;
+				entry->statements.evicted.pop_back();
+				result->pipeline_skip++;
+			}
+			if(!PQpipelineSync(conn))
+				return false;
+			result->pipeline_skip++;
+		}
+#endif
+		if(!PQsendPrepare(conn, name, query, params.count, params.oids))
+			return false;
+		result->pipeline_skip++;
+		return PQsendQueryPrepared(conn, name, params.count, params.values,
+								   params.lengths, params.formats, resultFormat) != 0;
+	}
+#endif
+	
+	// one command at a time, so hang on to the query until the prepare is done.
+	result->deferred = newQuery(query, NULL, params, resultFormat);
+	if(!entry->statements.evicted.empty())
+	{
+		std::string deallocate;
+		for(size_t ix = 0; ix < entry->statements.evicted.size(); ++ix)
+		{
+			deallocate += "DEALLOCATE ";
+			deallocate += entry->statements.evicted[ix];
+			deallocate += ";";
+		}
+		entry->statements.evicted.clear();
+		result->prepare_stage = uvpg_result::st_deallocate;
+		return PQsendQuery(conn, deallocate.c_str()) != 0;
+	}
+	result->prepare_stage = uvpg_result::st_prepare;
+	return PQsendPrepare(conn, name, query, params.count, params.oids) != 0;
+}
+
+bool UVPGPool::continuePrepare(uvpg_result *result)
+{
+	// returns false if the connection failed us, true if we're still waiting on something.
+	UVPGConnEntry *entry = result->entry;
+	bool failed = false;
+	while(true)
+	{
+		if(PQisBusy(entry->conn))
+			return true;
+		PGresult *res = PQgetResult(entry->conn);
+		if(res == NULL)
+			break;
+		if(PQresultStatus(res) != PGRES_COMMAND_OK)
+			failed = true;
+		PQclear(res);
+	}
+	
+	UVPGQuery *pgquery = result->deferred;
+	uvpg_param_arrays params = pgquery->params.arrays();
+	const char *key = result->prepared_key.c_str();
+	int sent;
+	if(result->prepare_stage == uvpg_result::st_deallocate)
+	{
+		// a failed DEALLOCATE is fine, the statement is gone either way.
+		result->prepare_stage = uvpg_result::st_prepare;
+		sent = PQsendPrepare(entry->conn, entry->statements.find(key), pgquery->query.c_str(), params.count, params.oids);
 	}
-	// if failure, queue request up, and wait for free connection.
 	else
 	{
-		UVPGQuery *pgquery = new UVPGQuery;
-		pgquery->query = strdup(query);
-		pgquery->params = new UVPGParams(*params);
-		pgquery->resultFormat = resultFormat;
+		result->prepare_stage = uvpg_result::st_none;
+		if(failed)
+		{
+			// couldn't prepare it, so don't pretend we did, and just run it.
+			entry->statements.remove(key);
+			sent = PQsendQueryParams(entry->conn, pgquery->query.c_str(), params.count, params.oids, params.values,
+									 params.lengths, params.formats, pgquery->resultFormat);
+		}
+		else
+		{
+			sent = PQsendQueryPrepared(entry->conn, entry->statements.find(key), params.count, params.values,
+									   params.lengths, params.formats, pgquery->resultFormat);
+		}
+		result->deferred = NULL;
+		releaseQuery(pgquery);
+	}
+	if(sent && !flushEntry(entry))
+		sent = 0;
+	if(!sent)
+	{
+		result->prepare_stage = uvpg_result::st_none;
+		return false;
+	}
+	if(result->prepare_stage == uvpg_result::st_none)
+		setRowMode(result);
+	setPollEvents(entry, UV_READABLE, entry->poll_cb);
+	return true;
+}
+
+void UVPGPool::setRowMode(uvpg_result *result)
+{
+	// has to happen right after the query itself goes out.  If it doesn't take, the
+	// results still arrive, just all at once.
+	if(result->stream_rows == 0)
+		return;
+#ifdef LIBPQ_HAS_CHUNK_MODE
+	if(result->stream_rows > 1)
+	{
+		PQsetChunkedRowsMode(result->entry->conn, result->stream_rows);
+		return;
+	}
+#endif
+	PQsetSingleRowMode(result->entry->conn);
+}
+
+UVPGQuery *UVPGPool::newQuery(const char *query, const char *statement, const uvpg_param_arrays &params, int resultFormat)
+{
+	UVPGQuery *pgquery = allocQuery();
+	pgquery->query.assign(query);
+	if(statement)
+		pgquery->statement.assign(statement);
+	pgquery->params.assign(params);
+	pgquery->resultFormat = resultFormat;
+	return pgquery;
+}
+
+UVPGQuery *UVPGPool::allocQuery()
+{
+	if(free_queries.empty())
+		return new UVPGQuery;
+	UVPGQuery *pgquery = free_queries.back();
+	free_queries.pop_back();
+	return pgquery;
+}
+
+void UVPGPool::releaseQuery(UVPGQuery *pgquery)
+{
+	if(pgquery == NULL)
+		return;
+	if(free_queries.size() >= UVPG_FREE_LIST_MAX)
+	{
+		delete pgquery;
+		return;
+	}
+	pgquery->reset();
+	free_queries.push_back(pgquery);
+}
+
+uvpg_result *UVPGPool::newResultStruct()
+{
+	if(free_results.empty())
+		return new uvpg_result;
+	uvpg_result *result = free_results.back();
+	free_results.pop_back();
+	return result;
+}
+
+void UVPGPool::releaseResult(uvpg_result *result)
+{
+	if(result == NULL)
+		return;
+	releaseQuery(result->deferred);
+	result->deferred = NULL;
+	if(free_results.size() >= UVPG_FREE_LIST_MAX)
+	{
+		delete result;
+		return;
+	}
+	result->reset();
+	free_results.push_back(result);
+}
+
+UVPGConnEntry *UVPGPool::getPipelinedConn()
+{
+	// least loaded of the connections we're already pipelining on.
+	UVPGConnEntry *best = NULL;
+	size_t count = pipelined.size();
+	for(size_t ix = 0; ix < count; ++ix)
+	{
+		UVPGConnEntry *entry = pipelined[ix];
+		if(entry->inflight.size() >= pipeline_depth)
+			continue;
+		if(best == NULL || entry->inflight.size() < best->inflight.size())
+			best = entry;
+	}
+	if(best)
+		return best;
+	
+#ifdef LIBPQ_HAS_PIPELINING
+	// all of them are full (or there are none), so pull another one from the pool.
+	UVPGConnEntry *entry = getFreeEntry(true);
+	if(entry == NULL)
+		return NULL;
+	if(PQenterPipelineMode(entry->conn) == 0)
+	{
+		returnEntry(entry);
+		return NULL;
+	}
+	entry->status.store(ConnStatus::cs_pipelined);
+	pipelined.push_back(entry);
+	
+	uvpg_result *reader = newResultStruct();
+	reader->entry = entry;
+	reader->data = this;
+	entry->poller->data = reader;
+	setPollEvents(entry, UV_READABLE, uvpg_read_pipeline);
+	return entry;
+#else
+	return NULL;
+#endif
+}
+
+void UVPGPool::failResult(uvpg_result *result)
+{
+	if(result->abandoned)
+	{
+		// its caller already heard about the timeout.
+		releaseResult(result);
+		return;
+	}
+	// a pipelined query's connection isn't the caller's, and is about to be disconnected.
+	PGconn *conn = result->entry && result->pipeline_stage == uvpg_result::ps_none ? result->entry->conn : NULL;
+	queryDone(result, true);
+	if(result->failure_cb)
+		result->failure_cb(conn, result->data);
+	else
+		result->result_cb(conn, result->data);
+	releaseResult(result);
+}
+
+void UVPGPool::pipelineReadable(UVPGConnEntry *entry)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	if(PQconsumeInput(entry->conn) == 0)
+	{
+		pipelineFailed(entry);
+		return;
+	}
+	while(!entry->inflight.empty() && PQisBusy(entry->conn) == 0)
+	{
+		uvpg_result *result = entry->inflight.front();
+		if(result->pipeline_stage == uvpg_result::ps_result && result->pipeline_skip > 0)
+		{
+			// results from statement cache upkeep sent ahead of the query.  Each statement's
+			// end with a NULL, a sync (after DEALLOCATEs) is just the one result.
+			PGresult *res = PQgetResult(entry->conn);
+			if(res == NULL)
+			{
+				result->pipeline_skip--;
+				continue;
+			}
+			ExecStatusType resstatus = PQresultStatus(res);
+			PQclear(res);
+			if(resstatus == PGRES_PIPELINE_SYNC)
+				result->pipeline_skip--;
+			else if((resstatus == PGRES_FATAL_ERROR || resstatus == PGRES_PIPELINE_ABORTED) && result->pipeline_skip == 1 && !result->prepared_key.empty())
+				entry->statements.remove(result->prepared_key.c_str()); // the prepare, always last.
+			continue;
+		}
+		if(result->pipeline_stage == uvpg_result::ps_result)
+		{
+			// the caller's PQgetResult() will pick up this query's result.
+			result->pipeline_stage = uvpg_result::ps_trailer;
+			result->deadline.unlink();
+			firstByte(result);
+			queryDone(result, false);
+			if(!result->abandoned)
+				result->result_cb(entry->conn, result->data);
+			continue;
+		}
+		// throw away whatever the callback didn't read, up to and including our sync.
+		PGresult *res = PQgetResult(entry->conn);
+		if(res == NULL)
+		{
+			result->pipeline_stage = uvpg_result::ps_sync;
+			continue;
+		}
+		ExecStatusType resstatus = PQresultStatus(res);
+		PQclear(res);
+		if(resstatus == PGRES_PIPELINE_SYNC)
+		{
+			entry->inflight.pop_front();
+			releaseResult(result);
+		}
+	}
+	if(entry->status.load() != ConnStatus::cs_pipelined)
+		return; // a callback managed to break the connection.
+	if(entry->inflight.empty())
+		pipelineDrained(entry);
+	else
+		checkQueuedRequests();
+#endif
+}
+
+void UVPGPool::pipelineDrained(UVPGConnEntry *entry)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+	// nothing left in flight, hand the connection back to the pool as a normal one.
+	setPollEvents(entry, UV_READABLE, NULL);
+	releaseResult((uvpg_result *)entry->poller->data);
+	entry->poller->data = NULL;
+	for(size_t ix = 0; ix < pipelined.size(); ++ix)
+	{
+		if(pipelined[ix] == entry)
+		{
+			pipelined.erase(pipelined.begin() + ix);
+			break;
+		}
+	}
+	PQexitPipelineMode(entry->conn);
+	if(atomicCAS(&(entry->status), &(ConnStatus::cs_pipelined), ConnStatus::cs_busy))
+		returnEntry(entry);
+#endif
+}
+
+void UVPGPool::pipelineFailed(UVPGConnEntry *entry)
+{
+	// the connection is no good, so nothing in flight on it will ever complete.
+	setPollEvents(entry, UV_READABLE, NULL);
+	releaseResult((uvpg_result *)entry->poller->data);
+	entry->poller->data = NULL;
+	for(size_t ix = 0; ix < pipelined.size(); ++ix)
+	{
+		if(pipelined[ix] == entry)
+		{
+			pipelined.erase(pipelined.begin() + ix);
+			break;
+		}
+	}
+	while(!entry->inflight.empty())
+	{
+		uvpg_result *result = entry->inflight.front();
+		entry->inflight.pop_front();
+		if(result->pipeline_stage == uvpg_result::ps_result)
+			failResult(result);
+		else
+			releaseResult(result); // its callback already had the result.
+	}
+	disconnect(entry);
+}
+
+void UVPGPool::sendQueryAndDo(const char *query, UVPGParams *params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb, const uvpg_query_opts *opts)
+{
+	sendQueryAndDo(query, params->arrays(), resultFormat, data, callback, failure_cb, opts);
+}
+
+void UVPGPool::sendQueryAndDo(const char *query, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb, const uvpg_query_opts *opts)
+{
+	const char *statement = opts ? opts->statement : NULL;
+	uint64_t expires = queryDeadline(opts);
+	uint64_t started = uv_hrtime();
+	// try to send on a free connection (or pipelined one),
+	// if failure, queue request up, and wait for free connection.
+	if(!dispatchQuery(query, statement, params, resultFormat, data, callback, failure_cb, expires, started))
+	{
+		UVPGQuery *pgquery = newQuery(query, statement, params, resultFormat);
+		pgquery->started_at = started;
 		pgquery->userdata = data;
 		pgquery->callback = callback;
 		pgquery->failure_cb = failure_cb;
-		printf("Adding pending query\n");
-		pendingQueries.push(pgquery);
+		queueQuery(pgquery, expires);
+	}
+}
+
+bool UVPGPool::dispatchDirect(const char *query, const char *statement, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_rows_cb rows_cb, int stream_rows, uvpg_result_cb done_cb, uvpg_result_cb failure_cb, uint64_t expires, uint64_t started)
+{
+	// on a connection of its own, never pipelined: streamed queries (rows_cb) and COPY (no
+	// rows_cb, which also keeps it away from the statement cache since COPY can't be prepared).
+	UVPGConnEntry *entry = getFreeEntry(true);
+	if(entry == NULL)
+		return false;
+	uvpg_result *result = newResultStruct();
+	result->entry = entry;
+	result->data = data;
+	result->result_cb = done_cb;
+	result->failure_cb = failure_cb;
+	result->rows_cb = rows_cb;
+	result->stream_rows = stream_rows;
+	// a COPY's "result" is just the COPY starting, which isn't worth timing.
+	querySent(result, started, rows_cb != NULL);
+	bool sent;
+	if(rows_cb)
+		sent = sendQuery(entry, result, query, statement, params, resultFormat);
+	else
+		sent = PQsendQueryParams(entry->conn, query, params.count, params.oids, params.values,
+								 params.lengths, params.formats, resultFormat) != 0;
+	if(!sent || !flushEntry(entry))
+	{
+		failResult(result);
+		return true;
+	}
+	if(result->prepare_stage == uvpg_result::st_none)
+		setRowMode(result);
+	entry->poller->data = result;
+	setPollEvents(entry, UV_READABLE, rows_cb ? uvpg_read_stream : uvpg_read_result);
+	if(expires)
+		armDeadline(&result->deadline, expires);
+	return true;
+}
+
+void UVPGPool::queueQuery(UVPGQuery *pgquery, uint64_t expires)
+{
+	if(breaker_open)
+	{
+		// no telling when the database will be back, don't make anyone wait for it.
+		failQuery(pgquery);
+		return;
+	}
+	if(expires)
+		armDeadline(&pgquery->deadline, expires);
+	pgquery->queued_at = uv_hrtime();
+	pendingQueries.push(pgquery);
+	pending_count++;
+}
+
+uint64_t UVPGPool::queryDeadline(const uvpg_query_opts *opts)
+{
+	if(opts && opts->timeout_ms > 0)
+		return (uint64_t)uv_now(eventloop) + opts->timeout_ms;
+	return 0;
+}
+
+void UVPGPool::streamQueryAndDo(const char *query, UVPGParams *params, int resultFormat, void *data, uvpg_rows_cb rows_cb, uvpg_result_cb done_cb, uvpg_result_cb failure_cb, const uvpg_query_opts *opts)
+{
+	const char *statement = opts ? opts->statement : NULL;
+	int stream_rows = (opts && opts->chunk_rows > 1) ? (int)opts->chunk_rows : 1;
+	uint64_t expires = queryDeadline(opts);
+	uint64_t started = uv_hrtime();
+	if(!dispatchDirect(query, statement, params->arrays(), resultFormat, data, rows_cb, stream_rows, done_cb, failure_cb, expires, started))
+	{
+		UVPGQuery *pgquery = newQuery(query, statement, params->arrays(), resultFormat);
+		pgquery->started_at = started;
+		pgquery->userdata = data;
+		pgquery->callback = done_cb;
+		pgquery->failure_cb = failure_cb;
+		pgquery->rows_cb = rows_cb;
+		pgquery->stream_rows = stream_rows;
+		pgquery->direct = true;
+		queueQuery(pgquery, expires);
+	}
+}
+
+void UVPGPool::copyIn(const char *query, void *data, uvpg_copy_cb write_cb, uvpg_result_cb done_cb, uvpg_result_cb failure_cb, const uvpg_query_opts *opts)
+{
+	startCopy(query, new UVPGCopyIn(this, data, write_cb, done_cb, failure_cb), opts);
+}
+
+void UVPGPool::copyOut(const char *query, void *data, uvpg_copy_data_cb data_cb, uvpg_result_cb done_cb, uvpg_result_cb failure_cb, const uvpg_query_opts *opts)
+{
+	startCopy(query, new UVPGCopyOut(this, data, data_cb, done_cb, failure_cb), opts);
+}
+
+void UVPGPool::startCopy(const char *query, UVPGCopy *copy, const uvpg_query_opts *opts)
+{
+	uvpg_param_arrays params;
+	uint64_t expires = queryDeadline(opts);
+	uint64_t started = uv_hrtime();
+	if(!dispatchDirect(query, NULL, params, FORMAT_TEXT, copy, NULL, 0, uvpg_copy_started, uvpg_copy_failed, expires, started))
+	{
+		UVPGQuery *pgquery = newQuery(query, NULL, params, FORMAT_TEXT);
+		pgquery->started_at = started;
+		pgquery->userdata = copy;
+		pgquery->callback = uvpg_copy_started;
+		pgquery->failure_cb = uvpg_copy_failed;
+		pgquery->direct = true;
+		queueQuery(pgquery, expires);
+	}
+}
+
+void UVPGPool::sendQueryAndDo(std::string &&query, UVPGParams &&params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb, const uvpg_query_opts *opts)
+{
+	const char *statement = opts ? opts->statement : NULL;
+	uint64_t expires = queryDeadline(opts);
+	uint64_t started = uv_hrtime();
+	if(dispatchQuery(query.c_str(), statement, params.arrays(), resultFormat, data, callback, failure_cb, expires, started))
+		return;
+	UVPGQuery *pgquery = allocQuery();
+	pgquery->started_at = started;
+	pgquery->query = std::move(query);
+	if(statement)
+		pgquery->statement.assign(statement);
+	pgquery->params = std::move(params);
+	pgquery->resultFormat = resultFormat;
+	pgquery->userdata = data;
+	pgquery->callback = callback;
+	pgquery->failure_cb = failure_cb;
+	queueQuery(pgquery, expires);
+}
+
+void UVPGPool::flightKey(const char *query, const uvpg_param_arrays &params, int resultFormat, std::string &key)
+{
+	// everything which could change the result, each piece with its length (or -1 for
+	// NULL) in front so that different splits of the same bytes don't look alike.
+	int32_t header[3] = { (int32_t)strlen(query), resultFormat, params.count };
+	key.assign((const char *)header, sizeof(header));
+	key.append(query, header[0]);
+	for(int ix = 0; ix < params.count; ++ix)
+	{
+		const char *value = params.values ? params.values[ix] : NULL;
+		int32_t param[3];
+		param[0] = params.oids ? (int32_t)params.oids[ix] : 0;
+		param[1] = params.formats ? params.formats[ix] : FORMAT_TEXT;
+		// as libpq goes: lengths only count for binary parameters, text ones end at the NUL.
+		if(value == NULL)
+			param[2] = -1;
+		else if(param[1] != FORMAT_TEXT && params.lengths)
+			param[2] = params.lengths[ix];
+		else
+			param[2] = (int32_t)strlen(value);
+		key.append((const char *)param, sizeof(param));
+		if(value)
+			key.append(value, param[2]);
+	}
+}
+
+void UVPGPool::sharedQueryAndDo(const char *query, UVPGParams *params, int resultFormat, void *data, uvpg_shared_cb callback, const uvpg_query_opts *opts)
+{
+	uvpg_param_arrays arrays;
+	if(params)
+		arrays = params->arrays();
+	sharedQueryAndDo(query, arrays, resultFormat, data, callback, opts);
+}
+
+void UVPGPool::sharedQueryAndDo(const char *query, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_shared_cb callback, const uvpg_query_opts *opts)
+{
+	flightKey(query, params, resultFormat, flight_key);
+	uint64_t hash = uvpg_hash_bytes(flight_key.data(), flight_key.size());
+	std::pair<std::unordered_multimap<uint64_t, uvpg_flight *>::iterator, std::unordered_multimap<uint64_t, uvpg_flight *>::iterator> range = flights.equal_range(hash);
+	for( ; range.first != range.second; ++range.first)
+	{
+		uvpg_flight *flight = range.first->second;
+		if(flight->key == flight_key)
+		{
+			flight->waiters.push_back(std::make_pair(callback, data));
+			metrics.coalesced++;
+			return;
+		}
 	}
+	
+	// first one, it goes out like any other query (and may fail straight away, which lands it).
+	uvpg_flight *flight = new uvpg_flight;
+	flight->pool = this;
+	flight->hash = hash;
+	flight->key.swap(flight_key);
+	flight->waiters.push_back(std::make_pair(callback, data));
+	flights.insert(std::make_pair(hash, flight));
+	sendQueryAndDo(query, params, resultFormat, flight, uvpg_flight_result, uvpg_flight_failed, opts);
+}
+
+void UVPGPool::flightLanded(uvpg_flight *flight, PGresult *res)
+{
+	// out of the table before any callbacks, so the same query asked from one of them goes
+	// out fresh rather than joining a result that's already been handed out.
+	std::pair<std::unordered_multimap<uint64_t, uvpg_flight *>::iterator, std::unordered_multimap<uint64_t, uvpg_flight *>::iterator> range = flights.equal_range(flight->hash);
+	for( ; range.first != range.second; ++range.first)
+	{
+		if(range.first->second == flight)
+		{
+			flights.erase(range.first);
+			break;
+		}
+	}
+	UVPGSharedResult *shared = res ? new UVPGSharedResult(res) : NULL;
+	for(size_t ix = 0; ix < flight->waiters.size(); ++ix)
+		flight->waiters[ix].first(shared, flight->waiters[ix].second);
+	if(shared)
+		shared->release();
+	delete flight;
 }
 
 void UVPGPool::checkQueuedRequests()
@@ -485,21 +1983,328 @@ void UVPGPool::checkQueuedRequests()
 	// check if we have any queued requests, and try to execute them.
 	while(!pendingQueries.empty())
 	{
-		// try to get a free connection
-		PGconn *conn = getFreeConn(true);
-		if(conn)
+		UVPGQuery *pgquery = pendingQueries.front();
+		if(pgquery->callback != NULL)
 		{
-			// execute this pending query.
-			UVPGQuery *pgquery = pendingQueries.front();
-			pendingQueries.pop();
-			UVPGParams *params = pgquery->params;
-			PQsendQueryParams(conn, pgquery->query, (int)params->size(), params->oids(),
-							  params->values(), params->lengths(), params->formats(), pgquery->resultFormat);
-			executeOnResult(conn, pgquery->userdata, pgquery->callback, pgquery->failure_cb);
-			delete params;
-			delete pgquery;
+			// whatever is left of its deadline carries over.
+			uint64_t expires = pgquery->deadline.armed() ? pgquery->deadline.expires : 0;
+			if(!dispatchQueued(pgquery, expires))
+				break;
 		}
+		pendingQueries.pop();
+		pending_count--;
+		releaseQuery(pgquery);
+	}
+}
+
+void UVPGPool::failQuery(UVPGQuery *pgquery)
+{
+	uvpg_result_cb callback = pgquery->failure_cb ? pgquery->failure_cb : pgquery->callback;
+	void *data = pgquery->userdata;
+	if(callback)
+		metrics.failures++;
+	pgquery->deadline.unlink();
+	releaseQuery(pgquery);
+	if(callback)
+		callback(NULL, data);
+}
+
+void UVPGPool::failQueued()
+{
+	while(!pendingQueries.empty())
+	{
+		UVPGQuery *pgquery = pendingQueries.front();
+		pendingQueries.pop();
+		pending_count--;
+		failQuery(pgquery); // one that timed out has no callback left to call.
+	}
+}
+
+bool UVPGPool::dispatchQueued(UVPGQuery *pgquery, uint64_t expires)
+{
+	bool sent;
+	if(pgquery->direct)
+		sent = dispatchDirect(pgquery->query.c_str(), pgquery->statementKey(), pgquery->params.arrays(), pgquery->resultFormat,
+							  pgquery->userdata, pgquery->rows_cb, pgquery->stream_rows, pgquery->callback, pgquery->failure_cb, expires, pgquery->started_at);
+	else
+		sent = dispatchQuery(pgquery->query.c_str(), pgquery->statementKey(), pgquery->params.arrays(), pgquery->resultFormat,
+							 pgquery->userdata, pgquery->callback, pgquery->failure_cb, expires, pgquery->started_at);
+	if(sent && pgquery->queued_at)
+		metrics.queue_wait.record((uv_hrtime() - pgquery->queued_at) / 1000);
+	return sent;
+}
+
+void UVPGPool::submitQuery(const char *query, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb, const uvpg_query_opts *opts)
+{
+	// not on the loop's thread, so no free list: a new query, which the loop recycles.
+	UVPGQuery *pgquery = new UVPGQuery;
+	pgquery->query.assign(query);
+	if(opts && opts->statement)
+		pgquery->statement.assign(opts->statement);
+	pgquery->params.assign(params);
+	pgquery->resultFormat = resultFormat;
+	pgquery->userdata = data;
+	pgquery->callback = callback;
+	pgquery->failure_cb = failure_cb;
+	pgquery->timeout_ms = opts ? opts->timeout_ms : 0;
+	pgquery->started_at = uv_hrtime();
+	submitQuery(pgquery);
+}
+
+void UVPGPool::submitQuery(UVPGQuery *pgquery)
+{
+	if(submitted.push(pgquery))
+		uv_async_send(&submit_msg);
+}
+
+void UVPGPool::submitQuery(const char *query, const uvpg_param_arrays &params, int resultFormat, UVPGReplyQueue *replies, void *data, uvpg_reply_cb callback, const uvpg_query_opts *opts)
+{
+	uvpg_reply *reply = new uvpg_reply;
+	reply->pool = this;
+	reply->queue = replies;
+	reply->callback = callback;
+	reply->data = data;
+	reply->result = NULL;
+	reply->queue_next = NULL;
+	submitQuery(query, params, resultFormat, reply, uvpg_reply_result, uvpg_reply_failed, opts);
+}
+
+void UVPGPool::dispatchSubmitted()
+{
+	// everything since the last wakeup, in the order it was submitted.  Whatever can't get
+	// a connection joins the queue, behind anything already waiting there.
+	UVPGQuery *pgquery = submitted.popAll();
+	while(pgquery != NULL)
+	{
+		UVPGQuery *next = pgquery->queue_next;
+		pgquery->queue_next = NULL;
+		uint64_t expires = pgquery->timeout_ms ? (uint64_t)uv_now(eventloop) + pgquery->timeout_ms : 0;
+		if(pendingQueries.empty() && dispatchQueued(pgquery, expires))
+			releaseQuery(pgquery);
 		else
-			break;
+			queueQuery(pgquery, expires);
+		pgquery = next;
+	}
+}
+
+UVPGQuery *UVPGPool::stealQueued(uvpg_result_cb callback)
+{
+	while(!pendingQueries.empty())
+	{
+		UVPGQuery *pgquery = pendingQueries.front();
+		if(pgquery->callback == NULL)
+		{
+			// timed out already, and its caller has been told.
+			pendingQueries.pop();
+			pending_count--;
+			releaseQuery(pgquery);
+			continue;
+		}
+		if(pgquery->direct || pgquery->callback != callback)
+			return NULL;
+		pendingQueries.pop();
+		pending_count--;
+		if(pgquery->deadline.armed())
+		{
+			uint64_t now = (uint64_t)uv_now(eventloop);
+			pgquery->timeout_ms = pgquery->deadline.expires > now ? (unsigned)(pgquery->deadline.expires - now) : 1;
+			pgquery->deadline.unlink();
+		}
+		return pgquery;
+	}
+	return NULL;
+}
+
+void UVPGPool::armDeadline(uvpg_timer_node *node, uint64_t expires)
+{
+	uint64_t now = (uint64_t)uv_now(eventloop);
+	bool idle = deadlines.empty();
+	deadlines.add(node, expires, now);
+	if(idle)
+		uv_timer_start(&deadline_timer, uvpg_deadline_tick, deadlines.tick(), deadlines.tick());
+}
+
+void UVPGPool::checkDeadlines()
+{
+	deadlines.advance((uint64_t)uv_now(eventloop), uvpg_deadline_expired, this);
+	if(deadlines.empty())
+		uv_timer_stop(&deadline_timer);
+}
+
+void UVPGPool::deadlineExpired(uvpg_timer_node *node)
+{
+	if(node->kind == 0)
+	{
+		// still waiting in pendingQueries.  it never got a connection, so there's none to hand over;
+		// checkQueuedRequests() drops it once it gets to the front.
+		UVPGQuery *pgquery = (UVPGQuery *)node->owner;
+		metrics.timeouts++;
+		metrics.failures++;
+		uvpg_result_cb callback = pgquery->failure_cb ? pgquery->failure_cb : pgquery->callback;
+		pgquery->callback = NULL;
+		pgquery->failure_cb = NULL;
+		callback(NULL, pgquery->userdata);
+		return;
+	}
+	
+	uvpg_result *result = (uvpg_result *)node->owner;
+	UVPGConnEntry *entry = result->entry;
+	metrics.timeouts++;
+	if(result->pipeline_stage != uvpg_result::ps_none)
+	{
+		// only the query at the front can be running, anything behind it hasn't started yet, so
+		// those are just abandoned.  Even the front one only gets cancelled while nothing at all
+		// has come back for it: once its result is on its way, the server has moved on to the
+		// next query, and a cancel would land on that instead.  (A result still on the wire when
+		// the cancel arrives can't be helped; the neighbour fails with 57014.)
+		if(entry->inflight.front() == result && PQisBusy(entry->conn) != 0)
+		{
+			struct pollfd readable = { PQsocket(entry->conn), POLLIN, 0 };
+			if(poll(&readable, 1, 0) == 0)
+				cancelQuery(entry);
+		}
+		if(result->failure_cb)
+		{
+			result->abandoned = true;
+			queryDone(result, true);
+			result->failure_cb(NULL, result->data);
+		}
+		return;
+	}
+	
+	cancelQuery(entry);
+	if(result->prepare_stage != uvpg_result::st_none)
+		entry->statements.remove(result->prepared_key.c_str()); // no telling if the prepare made it.
+	if(result->failure_cb)
+	{
+		// the connection is the caller's to return; validation drains the cancelled query.
+		setPollEvents(entry, UV_READABLE, NULL);
+		entry->poller->data = NULL;
+		queryDone(result, true);
+		result->failure_cb(entry->conn, result->data);
+		releaseResult(result);
+	}
+	// otherwise result_cb gets the cancelled query's error once it comes in.
+}
+
+void UVPGPool::cancelQuery(UVPGConnEntry *entry)
+{
+	PGcancel *cancel = PQgetCancel(entry->conn);
+	if(cancel == NULL)
+		return;
+	uvpg_cancel_req *req = new uvpg_cancel_req;
+	req->work.data = req;
+	req->entry = entry;
+	req->cancel = cancel;
+	entry->cancels_pending++;
+	uv_queue_work(eventloop, &req->work, uvpg_cancel_work, uvpg_cancel_done);
+}
+
+void UVPGPool::cancelDone(UVPGConnEntry *entry)
+{
+	entry->cancels_pending--;
+	if(entry->cancels_pending == 0 && entry->cancel_wait)
+	{
+		entry->cancel_wait = false;
+		if(entry->status.load() == ConnStatus::cs_validating)
+			validateConnection(entry);
 	}
 }
+
+// Metrics.
+void UVPGPool::querySent(uvpg_result *result, uint64_t started, bool timed)
+{
+	uint64_t now = uv_hrtime();
+	metrics.acquire_wait.record((now - started) / 1000);
+	if(!timed)
+		return;
+	result->started_at = started;
+	result->sent_at = now;
+}
+
+void UVPGPool::firstByte(uvpg_result *result)
+{
+	if(result->sent_at == 0)
+		return;
+	metrics.first_byte.record((uv_hrtime() - result->sent_at) / 1000);
+	result->sent_at = 0;
+}
+
+void UVPGPool::queryDone(uvpg_result *result, bool failed)
+{
+	// started_at is cleared so that a result is only ever counted once.
+	if(result->started_at == 0)
+		return;
+	if(failed)
+		metrics.failures++;
+	else
+	{
+		metrics.query_time.record((uv_hrtime() - result->started_at) / 1000);
+		metrics.queries++;
+	}
+	result->started_at = 0;
+	result->sent_at = 0;
+}
+
+void UVPGPool::getMetrics(uvpg_pool_snapshot &out)
+{
+	for(int ix = 0; ix < UVPG_CONN_STATES; ++ix)
+		out.states[ix] = 0;
+	size_t count = connections.size();
+	for(size_t ix = 0; ix < count; ++ix)
+	{
+		uint8_t status = connections[ix]->status.load();
+		if(status < UVPG_CONN_STATES)
+			out.states[status]++;
+	}
+	out.pending = pending_count.load();
+	out.queries = metrics.queries.load();
+	out.failures = metrics.failures.load();
+	out.timeouts = metrics.timeouts.load();
+	out.coalesced = metrics.coalesced.load();
+	metrics.acquire_wait.snapshot(out.acquire_wait);
+	metrics.queue_wait.snapshot(out.queue_wait);
+	metrics.first_byte.snapshot(out.first_byte);
+	metrics.query_time.snapshot(out.query_time);
+}
+
+void UVPGPool::metricsText(std::string &out, const char *prefix)
+{
+	uvpg_pool_snapshot snap;
+	getMetrics(snap);
+	char name[128];
+	char line[256];
+	
+	snprintf(line, sizeof(line), "# HELP %s_connections Connections in each state.\n# TYPE %s_connections gauge\n", prefix, prefix);
+	out += line;
+	for(int ix = 0; ix < UVPG_CONN_STATES; ++ix)
+	{
+		snprintf(line, sizeof(line), "%s_connections{state=\"%s\"} %u\n", prefix, uvpg_state_names[ix], snap.states[ix]);
+		out += line;
+	}
+	snprintf(line, sizeof(line), "# HELP %s_pending_queries Queries waiting for a connection.\n# TYPE %s_pending_queries gauge\n%s_pending_queries %u\n",
+			 prefix, prefix, prefix, snap.pending);
+	out += line;
+	snprintf(line, sizeof(line), "# HELP %s_queries_total Query results handed over.\n# TYPE %s_queries_total counter\n%s_queries_total %llu\n",
+			 prefix, prefix, prefix, (unsigned long long)snap.queries);
+	out += line;
+	snprintf(line, sizeof(line), "# HELP %s_failures_total Queries that failed, timeouts included.\n# TYPE %s_failures_total counter\n%s_failures_total %llu\n",
+			 prefix, prefix, prefix, (unsigned long long)snap.failures);
+	out += line;
+	snprintf(line, sizeof(line), "# HELP %s_timeouts_total Queries that ran past their deadline.\n# TYPE %s_timeouts_total counter\n%s_timeouts_total %llu\n",
+			 prefix, prefix, prefix, (unsigned long long)snap.timeouts);
+	out += line;
+	
+	snprintf(line, sizeof(line), "# HELP %s_coalesced_total Queries which shared another one's result.\n# TYPE %s_coalesced_total counter\n%s_coalesced_total %llu\n",
+			 prefix, prefix, prefix, (unsigned long long)snap.coalesced);
+	out += line;
+	
+	snprintf(name, sizeof(name), "%s_acquire_wait_seconds", prefix);
+	uvpg_histogram_text(out, name, "Time from asking for a query until it had a connection.", snap.acquire_wait);
+	snprintf(name, sizeof(name), "%s_queue_wait_seconds", prefix);
+	uvpg_histogram_text(out, name, "Time queued queries spent waiting for a connection.", snap.queue_wait);
+	snprintf(name, sizeof(name), "%s_first_byte_seconds", prefix);
+	uvpg_histogram_text(out, name, "Time from sending a query until its result started coming in.", snap.first_byte);
+	snprintf(name, sizeof(name), "%s_query_seconds", prefix);
+	uvpg_histogram_text(out, name, "Time from asking for a query until its result was handed over.", snap.query_time);
+}
@@ -49,17 +49,83 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <atomic>
 #include <queue>
+#include <deque>
+#include <list>
+#include <string>
+#include <unordered_map>
 #include <cstdint>
+#include <cstdlib>
 
 #include "UVPGParams.h"
+#include "UVPGTypedParams.h"
+#include "UVPGTimerWheel.h"
+#include "UVPGSubmitQueue.h"
+#include "UVPGMetrics.h"
+
+class UVPGCopy;
+class UVPGCopyIn;
+class UVPGCopyOut;
+class UVPGPool;
 
 typedef void (*uvpg_result_cb)(PGconn *conn, void *data);
+// streamed results: every PGresult of the query as it comes in, cleared once the callback returns.
+typedef void (*uvpg_rows_cb)(PGresult *res, void *data);
+typedef void (*uvpg_copy_cb)(UVPGCopyIn *copy, void *data);
+typedef void (*uvpg_copy_data_cb)(UVPGCopyOut *copy, const char *buffer, int length, void *data);
+// a query's result, delivered on another loop (see UVPGReplyQueue).  Yours to PQclear(); NULL
+// if the query failed to run or timed out.
+typedef void (*uvpg_reply_cb)(PGresult *res, void *data);
+typedef void (*uvpg_pool_cb)(UVPGPool *pool, void *data);
+class UVPGSharedResult;
+// a sharedQueryAndDo() result, NULL if the query failed to run or timed out.
+typedef void (*uvpg_shared_cb)(UVPGSharedResult *res, void *data);
+
+// opaque reference to a checked out connection: the entry's slot in the pool, and the
+// entry's generation when it was handed out, so a handle kept past returnConnection()
+// is caught instead of touching whoever has the connection now.
+typedef uint64_t uvpg_conn_handle;
+#define UVPG_INVALID_HANDLE 0
 
 class ConnStatus
 {
 public:
 	static uint8_t cs_invalid, cs_disconnecting, cs_connecting, cs_available,
-	cs_busy, cs_validating, cs_idle_ready;
+	cs_busy, cs_validating, cs_idle_ready, cs_pipelined;
+};
+
+class uvpg_result;
+
+// optional per-query settings for sendQueryAndDo.
+class uvpg_query_opts
+{
+public:
+	uvpg_query_opts() : statement(NULL), timeout_ms(0), chunk_rows(0), read_only(false) { };
+	const char *statement; // prepared statement cache key to use instead of the query text.
+	unsigned timeout_ms; // give up on the query after this long, queued or running.  0 = never.
+	unsigned chunk_rows; // streamQueryAndDo only: rows per result with libpq 17+, otherwise always 1.
+	bool read_only; // UVPGRoutedPool only: may run on a replica.
+};
+
+// per-connection LRU of server-side prepared statements, keyed by query text
+// (or a caller supplied statement id).  Names are never reused on a connection.
+class UVPGStatementCache
+{
+private:
+	typedef std::list<std::pair<std::string, std::string> > lru_list; // <key, name>, most recent first.
+	lru_list lru;
+	std::unordered_multimap<uint64_t, lru_list::iterator> index;
+	unsigned next_id;
+	
+	lru_list::iterator lookup(const char *key, uint64_t hash);
+	
+public:
+	UVPGStatementCache() : next_id(0) { };
+	std::vector<std::string> evicted; // still prepared on the server, but no longer cached.
+	
+	const char *find(const char *key);
+	const char *add(const char *key, size_t capacity);
+	void remove(const char *key);
+	void clear();
 };
 
 
@@ -68,54 +134,324 @@ public:
 class UVPGConnEntry
 {
 public:
-	UVPGConnEntry() : conn(NULL) { status.store(ConnStatus::cs_invalid); };
-	UVPGConnEntry(const UVPGConnEntry &rhs) : conn(rhs.conn) { status.store(rhs.status.load()); };
+	// which UVPGEntryStack an entry's links belong to.
+	enum { free_stack, return_stack, stack_count };
+	// what returning a connection has done to it so far (see UVPGPool::validateConnection).
+	enum { vs_none, vs_rollback, vs_session_reset };
+	
+	UVPGConnEntry() : conn(NULL), pool(NULL), index(0), poller(NULL), poller_fd(-1), poll_events(0), poll_cb(NULL), flushing(false), resetting(false), validate_step(vs_none), cancels_pending(0), cancel_wait(false), connected_at(0), last_used(0) { init(); };
+	UVPGConnEntry(const UVPGConnEntry &rhs) : conn(rhs.conn), pool(rhs.pool), index(rhs.index), poller(NULL), poller_fd(-1), poll_events(0), poll_cb(NULL), flushing(false), resetting(false), validate_step(vs_none), cancels_pending(0), cancel_wait(false), connected_at(rhs.connected_at), last_used(rhs.last_used) { init(); status.store(rhs.status.load()); generation.store(rhs.generation.load()); };
 	std::atomic<uint8_t> status;
 	PGconn *conn;
-	uv_poll_t poller; // only one uv_poll_s per connection.
+	UVPGPool *pool;
+	uint32_t index; // position in UVPGPool::connections
+	std::atomic<uint32_t> generation; // bumped every time the entry is checked out or returned.
+	std::atomic<uint32_t> stack_next[stack_count]; // index+1 of the entry below us (0 = bottom).
+	std::atomic<bool> on_stack[stack_count];
+	uv_poll_t *poller; // only one uv_poll_s per connection, replaced if the socket changes.
+	int poller_fd;
+	int poll_events; // what the poller is started for (0 = stopped), see UVPGPool::setPollEvents.
+	uv_poll_cb poll_cb; // whoever has the connection's events at the moment, NULL while idle.
+	bool flushing; // part of a query is still in libpq's buffer, waiting on the socket.
+	bool resetting; // being watched through PQresetPoll rather than PQconnectPoll
+	int validate_step;
+	int cancels_pending; // PQcancel()s still out on a worker thread.
+	bool cancel_wait; // validated, but waiting on those before it's made available.
+	uint64_t connected_at; // uv_now() when the session was (re)established.
+	uint64_t last_used; // uv_now() when it was last made available by a connect or a return.
+	std::deque<uvpg_result *> inflight; // pipeline mode only: queries awaiting results, in send order.
+	UVPGStatementCache statements;
+	
+private:
+	void init()
+	{
+		status.store(ConnStatus::cs_invalid);
+		generation.store(1);
+		for(int ix = 0; ix < stack_count; ++ix)
+		{
+			stack_next[ix].store(0);
+			on_stack[ix].store(false);
+		}
+	};
+};
+
+// lock-free (Treiber) stack of entries, linked through the entries themselves.  The head
+// holds the top entry's index+1 in the low 32 bits and a tag, bumped on every change,
+// in the high 32 bits so that a pop can't be fooled by ABA.  An entry is only ever on
+// a given stack once; pushing one that's already there does nothing.
+class UVPGEntryStack
+{
+private:
+	std::atomic<uint64_t> head;
+	std::vector<UVPGConnEntry *> *entries;
+	int link;
+public:
+	UVPGEntryStack(std::vector<UVPGConnEntry *> *in_entries, int in_link) : head(0), entries(in_entries), link(in_link) { };
+	void push(UVPGConnEntry *entry);
+	UVPGConnEntry *pop();
+};
+
+// a query waiting for a connection (or for its statement to be prepared).  Pooled by
+// UVPGPool and reused, strings and parameters included, so queueing one seldom allocates.
+class UVPGQuery
+{
+public:
+	UVPGQuery() { deadline.owner = this; reset(); };
+	std::string query;
+	std::string statement; // empty: keyed by the query text.
+	UVPGParams params;
+	int resultFormat;
+	void *userdata;
+	uvpg_result_cb callback; // NULL once the query has timed out waiting in the queue.
+	uvpg_result_cb failure_cb;
+	uvpg_rows_cb rows_cb;
+	int stream_rows;
+	bool direct; // goes through dispatchDirect() (streams, COPY).
+	uvpg_timer_node deadline;
+	unsigned timeout_ms; // submitQuery(): deadline still to be armed, once it reaches the loop.
+	UVPGQuery *queue_next; // UVPGSubmitQueue link.
+	uint64_t started_at; // uv_hrtime() when the query was asked for.
+	uint64_t queued_at; // uv_hrtime() when it joined pendingQueries (0 if it never did).
+	
+	const char *statementKey() { return statement.empty() ? NULL : statement.c_str(); }
+	void reset()
+	{
+		query.clear();
+		statement.clear();
+		params.clear();
+		resultFormat = 0;
+		userdata = NULL;
+		callback = NULL;
+		failure_cb = NULL;
+		rows_cb = NULL;
+		stream_rows = 0;
+		direct = false;
+		deadline.unlink();
+		timeout_ms = 0;
+		queue_next = NULL;
+		started_at = 0;
+		queued_at = 0;
+	};
 };
 
 class uvpg_result
 {
 public:
-	uvpg_result() : entry(NULL), data(NULL) { };
+	// where a pipelined query is in its result stream: its own result(s),
+	// the NULL terminating them, then the PGRES_PIPELINE_SYNC we sent after it.
+	enum { ps_none, ps_result, ps_trailer, ps_sync };
+	// statement cache miss outside of pipeline mode: each step needs its own round-trip.
+	enum { st_none, st_deallocate, st_prepare };
+	
+	uvpg_result() : deferred(NULL) { deadline.owner = this; deadline.kind = 1; reset(); };
 	UVPGConnEntry *entry;
 	void *data;
 	uvpg_result_cb result_cb;
 	uvpg_result_cb failure_cb;
+	int pipeline_stage;
+	int pipeline_skip;  // results of statement cache upkeep to swallow before ours.
+	int prepare_stage;
+	UVPGQuery *deferred; // what to execute once prepare_stage is done.
+	std::string prepared_key; // cache entry to drop if the PQsendPrepare fails.
+	uvpg_timer_node deadline; // kind 1, queued queries (UVPGQuery) use kind 0.
+	bool abandoned; // timed out in a pipeline, its results just get thrown away.
+	uvpg_rows_cb rows_cb; // streaming: gets each result, result_cb is only called at the end.
+	int stream_rows; // streaming: 1 for single row mode, more for chunked mode.
+	uint64_t started_at; // uv_hrtime() when the query was asked for, 0 if it isn't one of the pool's.
+	uint64_t sent_at; // uv_hrtime() when it went out, 0 once its first byte has come in.
+	
+	~uvpg_result() { delete deferred; };
+	// back to new, for reuse (see UVPGPool::releaseResult, which takes care of deferred).
+	void reset()
+	{
+		entry = NULL;
+		data = NULL;
+		result_cb = NULL;
+		failure_cb = NULL;
+		pipeline_stage = ps_none;
+		pipeline_skip = 0;
+		prepare_stage = st_none;
+		prepared_key.clear();
+		deadline.unlink();
+		abandoned = false;
+		rows_cb = NULL;
+		stream_rows = 0;
+		started_at = 0;
+		sent_at = 0;
+	};
 };
 
-class UVPGPool
+class UVPGReplyQueue;
+
+// a submitQuery() result on its way to another loop.
+class uvpg_reply
+{
+public:
+	UVPGPool *pool;
+	UVPGReplyQueue *queue;
+	uvpg_reply_cb callback;
+	void *data;
+	PGresult *result;
+	uvpg_reply *queue_next; // UVPGSubmitQueue link.
+};
+
+// a PGresult handed to everyone who asked for the same query (see sharedQueryAndDo), so
+// don't PQclear() it.  It's good until the callback returns; retain() it to keep it longer,
+// and release() it when done.  The last release() clears it.
+class UVPGSharedResult
 {
 private:
-	class UVPGQuery
-	{
-	public:
-		char *query;
-		UVPGParams *params;
-		int resultFormat;
-		void *userdata;
-		uvpg_result_cb callback;
-		uvpg_result_cb failure_cb;
-	};
+	PGresult *res;
+	std::atomic<unsigned> refs;
+	~UVPGSharedResult() { PQclear(res); };
+	
+public:
+	UVPGSharedResult(PGresult *in_res) : res(in_res), refs(1) { };
+	PGresult *get() { return res; };
+	void retain() { refs++; };
+	void release() { if(--refs == 0) delete this; };
+};
+
+// a sharedQueryAndDo() query on its way, and everyone waiting on it.
+class uvpg_flight
+{
+public:
+	UVPGPool *pool;
+	uint64_t hash;
+	std::string key; // query text, result format and parameters, see UVPGPool::flightKey.
+	std::vector<std::pair<uvpg_shared_cb, void *> > waiters;
+};
+
+// delivers query results on a loop other than the pool's.  Create it on the thread that runs
+// 'loop', and hand it to UVPGPool::submitQuery(); callbacks then run on that loop, in
+// batches, as a uv_async_t wakes it.  close() (on the same thread) gets rid of it, once
+// there's nothing left in flight for it.
+class UVPGReplyQueue
+{
+private:
+	uv_async_t async;
+	UVPGSubmitQueue<uvpg_reply> replies;
+	~UVPGReplyQueue() { };
+	
+public:
+	UVPGReplyQueue(uv_loop_t *loop);
+	void post(uvpg_reply *reply); // any thread.
+	void deliver();
+	void close();
+	friend void uvpg_reply_closed(uv_handle_t *handle);
+};
+
+// how many spare uvpg_result and UVPGQuery structures a pool holds on to.
+#define UVPG_FREE_LIST_MAX 1024
+
+// reconnect backoff after failed connection attempts: doubles from the base up to the max,
+// and each wait is somewhere between half and all of that.
+#define UVPG_BACKOFF_BASE_MS 100
+#define UVPG_BACKOFF_MAX_MS 30000
+// how often idle connections are pinged.
+#define UVPG_HEALTH_INTERVAL_MS 30000
+// failed connection attempts in a row before queued queries start failing fast.
+#define UVPG_BREAKER_FAILURES 5
+// connections beyond min_connections idle this long are closed.
+#define UVPG_IDLE_TIMEOUT_MS 60000
+// how often the pool looks for idle (or too old) connections to close.
+#define UVPG_REAP_INTERVAL_MS 1000
+
+class UVPGPool
+{
+	friend class UVPGCopy;
+	friend class UVPGPoolBench; // bench/pool_hotpaths.cpp, runs the pool on stand-in connections.
 private:
 	uv_loop_t *eventloop;
 	const char *connstring;
 	uv_async_t reset_msg;
+	uv_async_t submit_msg;
+	uv_async_t grow_msg; // getFreeEntry() ran short, from whatever thread.
+	UVPGSubmitQueue<UVPGQuery> submitted; // from submitQuery(), any thread.
+	uv_timer_t deadline_timer;
+	UVPGTimerWheel deadlines;
+	uv_timer_t reconnect_timer;
+	uv_timer_t health_timer;
+	uv_timer_t reap_timer;
 	
 	unsigned min_connections;
 	unsigned max_connections;
 	unsigned min_free_connections;
 	unsigned max_free_connections;
+	unsigned pipeline_depth;
+	unsigned statement_cache_size;
+	std::atomic<uint64_t> statement_hits;
+	std::atomic<uint64_t> statement_misses;
+	
+	std::vector<UVPGConnEntry *> connections; // reserved up front, never reallocates.
+	std::vector<UVPGConnEntry *> pipelined;
 	
-	std::vector<UVPGConnEntry *> connections;
+	// available entries, most recently returned on top.  entries can linger on it after
+	// being taken some other way; popFreeEntry skips those.
+	UVPGEntryStack free_entries;
+	// returned entries waiting for the loop to validate them.
+	UVPGEntryStack returned_entries;
+	const char *session_reset_query;
+	std::atomic<unsigned> available_count;
+	std::atomic<unsigned> connecting_count;
+	std::atomic<unsigned> open_count; // anything but cs_invalid
 	std::queue<UVPGQuery *> pendingQueries;
+	std::atomic<unsigned> pending_count; // pendingQueries.size(), readable from any thread.
+	UVPGPoolMetrics metrics;
+	std::unordered_multimap<uint64_t, uvpg_flight *> flights; // sharedQueryAndDo() queries in flight.
+	std::string flight_key; // scratch, so looking up a flight doesn't allocate.
+	
+	unsigned backoff_base_ms;
+	unsigned backoff_max_ms;
+	unsigned connect_failures; // in a row, since the last connection that made it.
+	std::atomic<uint64_t> reconnect_at; // uv_now() before which no new connections are started.
+	unsigned breaker_failures;
+	bool breaker_open; // database unreachable: queries fail instead of queueing.
+	unsigned health_interval_ms;
+	unsigned idle_timeout_ms;
+	unsigned max_lifetime_ms;
+	uvpg_pool_cb ready_cb;
+	void *ready_data;
+	bool ready; // min_connections have been up (ready_cb has been called).
+	// spares, so the per query bookkeeping isn't a new/delete every time.  Loop thread only.
+	std::vector<uvpg_result *> free_results;
+	std::vector<UVPGQuery *> free_queries;
 	
 	void watchConnectionState(UVPGConnEntry *newconn);
 	void createNewConnections(unsigned count=0);
 	void disconnect(PGconn *entry);
 	void disconnect(UVPGConnEntry *entry);
 	UVPGConnEntry *findConnEntry(PGconn *conn);
+	UVPGConnEntry *findConnEntry(uvpg_conn_handle handle);
+	void attachConn(UVPGConnEntry *entry);
+	UVPGConnEntry *getFreeEntry(bool add_more);
+	bool makeAvailable(UVPGConnEntry *entry, uint8_t from_status);
+	UVPGConnEntry *popFreeEntry();
+	void releasePoller(UVPGConnEntry *entry);
+	void resetConnection(UVPGConnEntry *entry);
+	void returnEntry(UVPGConnEntry *entry);
+	
+	bool dispatchQuery(const char *query, const char *statement, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb, uint64_t expires, uint64_t started);
+	bool dispatchDirect(const char *query, const char *statement, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_rows_cb rows_cb, int stream_rows, uvpg_result_cb done_cb, uvpg_result_cb failure_cb, uint64_t expires, uint64_t started);
+	void querySent(uvpg_result *result, uint64_t started, bool timed);
+	void queueQuery(UVPGQuery *pgquery, uint64_t expires);
+	bool dispatchQueued(UVPGQuery *pgquery, uint64_t expires);
+	void startCopy(const char *query, UVPGCopy *copy, const uvpg_query_opts *opts);
+	static void flightKey(const char *query, const uvpg_param_arrays &params, int resultFormat, std::string &key);
+	uint64_t queryDeadline(const uvpg_query_opts *opts);
+	void armDeadline(uvpg_timer_node *node, uint64_t expires);
+	void cancelQuery(UVPGConnEntry *entry);
+	bool sendQuery(UVPGConnEntry *entry, uvpg_result *result, const char *query, const char *statement, const uvpg_param_arrays &params, int resultFormat);
+	UVPGQuery *newQuery(const char *query, const char *statement, const uvpg_param_arrays &params, int resultFormat);
+	UVPGQuery *allocQuery();
+	void releaseQuery(UVPGQuery *pgquery);
+	UVPGConnEntry *getPipelinedConn();
+	void failResult(uvpg_result *result);
+	void pipelineDrained(UVPGConnEntry *entry);
+	bool backingOff();
+	void failQuery(UVPGQuery *pgquery);
+	void failQueued();
+	void checkReady();
 	
 public:
 	UVPGPool(uv_loop_t *in_loop, const char *in_connstring, unsigned in_min_connections=5, unsigned in_min_free_connections=2, unsigned in_max_connections=20, unsigned in_max_free_connections=7);
@@ -125,19 +461,156 @@ public:
 	void connectionFailed(UVPGConnEntry *entry);
 	void connectionReady(UVPGConnEntry *entry);
 	void checkIdleConnections();
+	void validateConnection(UVPGConnEntry *entry);
+	void attachPoller(UVPGConnEntry *entry);
+	void setPollEvents(UVPGConnEntry *entry, int events, uv_poll_cb callback);
+	bool flushEntry(UVPGConnEntry *entry);
+	void idleEvent(UVPGConnEntry *entry, int status);
+	void pipelineReadable(UVPGConnEntry *entry);
+	void pipelineFailed(UVPGConnEntry *entry);
+	bool continuePrepare(uvpg_result *result);
+	void setRowMode(uvpg_result *result);
+	void checkDeadlines();
+	void deadlineExpired(uvpg_timer_node *node);
+	void cancelDone(UVPGConnEntry *entry);
+	void reconnect();
+	void growConnections();
+	void checkHealth();
+	void healthChecked(PGconn *conn, bool failed);
+	void reapConnections();
+	void firstByte(uvpg_result *result);
+	void flightLanded(uvpg_flight *flight, PGresult *res);
+	void queryDone(uvpg_result *result, bool failed);
+	
+	// connection failures.  Failed connects back off exponentially (with jitter) before the
+	// next try, rather than retrying on every getFreeConn().  After 'failures' of them in a row
+	// (0 never) the circuit breaker opens: queued queries fail, and new ones fail straight away
+	// instead of queueing, with failure_cb(NULL, data) (or callback), until a connection gets
+	// through again.  Idle connections are pinged every health check interval (0 never), and
+	// reset if they don't answer.
+	void setReconnectBackoff(unsigned base_ms, unsigned max_ms);
+	void setCircuitBreaker(unsigned failures) { breaker_failures = failures; }
+	bool circuitOpen() { return breaker_open; }
+	void setHealthCheckInterval(unsigned ms);
+	// called once, as soon as min_connections are connected (straight away, if they already are).
+	void setReadyCallback(uvpg_pool_cb callback, void *data);
+	
+	// pool sizing, done by a timer rather than when connections are returned.  Connections idle
+	// for longer than the idle timeout (0 never) are closed, down to min_connections; so are
+	// available connections beyond max_free_connections, once they've been idle a whole check.
+	// Connections older than the max lifetime (0 never, the default) are replaced, one per check,
+	// so long lived backends get rotated out without dropping them all at once.
+	void setIdleTimeout(unsigned ms) { idle_timeout_ms = ms; }
+	void setMaxLifetime(unsigned ms) { max_lifetime_ms = ms; }
+	
+	// how the pool is doing: connections in each state, the queue, and histograms of where
+	// queries spend their time (see UVPGPoolMetrics).  Either one can be called from any thread.
+	void getMetrics(uvpg_pool_snapshot &out);
+	// the same, in Prometheus' text format, with each metric's name starting with prefix.
+	void metricsText(std::string &out, const char *prefix = "uvpg");
 	
 	// routines for getting a connection, and getting rid of it (because you're done).
+	// the handle versions are constant time and catch stale handles; the PGconn * versions
+	// are kept for compatibility (and callbacks, which are handed a PGconn *).
+	// returnConnection() only flags the connection and wakes the loop, so it is safe from
+	// any thread.  The loop then drains anything left unread, ROLLBACKs an open transaction
+	// and runs the session reset query (if set), all without blocking; only a connection
+	// which is actually broken (or stuck in COPY) gets reset, with PQresetStart().
+	// The reset query runs on every return, e.g. "DISCARD ALL", and flushes the statement cache.
+	void setSessionResetQuery(const char *query) { session_reset_query = query; }
+	
+	uvpg_conn_handle acquireConn(bool add_more=true);
+	PGconn *handleConn(uvpg_conn_handle handle);
+	void returnConnection(uvpg_conn_handle handle);
 	PGconn *getFreeConn(bool add_more=true);
 	void returnConnection(PGconn *in_conn);
+	// the pool a connection belongs to, or NULL if it isn't one of ours.
+	static UVPGPool *poolOf(PGconn *conn);
+	uv_loop_t *getLoop() { return eventloop; }
 	
 	// various handling routines for how to execute a callback when a result comes in.
 	// they ultimately all call the first (using a uvpg_result *)
-	uvpg_result *newResultStruct() { return new uvpg_result; }
+	// (loop thread only) result structures come from a free list; hand them back with releaseResult().
+	uvpg_result *newResultStruct();
+	void releaseResult(uvpg_result *result);
 	void executeOnResult(uvpg_result *in_conn, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL);
 	void executeOnResult(PGconn *in_conn, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL);
 	void executeOnResult(PGconn *in_conn, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL);
+	void executeOnResult(uvpg_conn_handle handle, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL);
+	
+	// pipeline mode: with a depth > 1, sendQueryAndDo keeps up to 'depth' queries in flight on
+	// each connection it uses (libpq 14+).  Callbacks for pipelined queries should call
+	// PQgetResult() once and must not expect returnConnection() to do anything; the pool
+	// owns pipelined connections and hands them back when their queue drains.  0 disables.
+	void setPipelineDepth(unsigned depth);
 	
-	void sendQueryAndDo(const char *query, UVPGParams *params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL);
+	// prepared statement cache: once set, sendQueryAndDo prepares each query (keyed by its text,
+	// or opts->statement) the first time a connection sees it, and executes the prepared
+	// statement from then on.  Holds up to 'size' statements per connection.  0 disables.
+	void setStatementCacheSize(unsigned size) { statement_cache_size = size; }
+	uint64_t statementCacheHits() { return statement_hits.load(); }
+	uint64_t statementCacheMisses() { return statement_misses.load(); }
+	
+	// with opts->timeout_ms set, a query still queued when it runs out of time fails with
+	// failure_cb(NULL, data) (or callback(NULL, data)) and never takes a connection.  A running
+	// query gets cancelled on the server (PQcancel, off the loop) and failure_cb is called with
+	// its connection right away, which you return as usual (in pipeline mode it gets NULL, the
+	// connection isn't yours, and only a query the server hasn't started answering is cancelled;
+	// see deadlineExpired).  Without a failure_cb the callback fires normally once the
+	// cancelled query's (error) result is in.
+	void sendQueryAndDo(const char *query, UVPGParams *params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL, const uvpg_query_opts *opts=NULL);
+	// same, but the pool takes over the query string and parameters instead of copying them,
+	// should the query have to wait for a connection.
+	void sendQueryAndDo(std::string &&query, UVPGParams &&params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL, const uvpg_query_opts *opts=NULL);
+	// same, straight from parallel arrays (as PQsendQueryParams takes them), see uvpg_param_arrays.
+	// Nothing is copied unless the query has to wait for a connection.  UVPGTypedParams.h builds
+	// these on the stack from typed arguments.
+	void sendQueryAndDo(const char *query, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL, const uvpg_query_opts *opts=NULL);
+	// typed parameters, given explicitly: query<int32_t, const char *>(sql, id, name, FORMAT_BINARY, data, callback).
+	// Oids and formats are worked out at compile time, values encoded on the stack (UVPGTypedParams).
+	template<class... _Ts>
+	void query(const char *query, _Ts... values, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL, const uvpg_query_opts *opts=NULL)
+	{
+		sendQueryAndDo(query, UVPGTypedParams<_Ts...>(values...).arrays(), resultFormat, data, callback, failure_cb, opts);
+	}
+	// for the same lookups arriving in bursts: a query identical to one already queued or running
+	// (same text, result format, and parameter values, formats and Oids) doesn't take another
+	// connection, it waits for that one's result.  Everyone gets the same UVPGSharedResult, and the
+	// pool takes care of the connection.  The first query's opts (deadline included) go for all.
+	void sharedQueryAndDo(const char *query, UVPGParams *params, int resultFormat, void *data, uvpg_shared_cb callback, const uvpg_query_opts *opts=NULL);
+	void sharedQueryAndDo(const char *query, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_shared_cb callback, const uvpg_query_opts *opts=NULL);
+	// streaming version, for results too big to hold in memory at once: the query runs in single
+	// row mode (or chunked mode, opts->chunk_rows, with libpq 17+) and rows_cb gets every result
+	// as it arrives, PGRES_SINGLE_TUPLE/PGRES_TUPLES_CHUNK ones and then the final status (or an
+	// error).  Once there's nothing left, done_cb gets the connection, to return as usual; there's
+	// nothing left for it to PQgetResult().  Never pipelined, one stream per connection.
+	void streamQueryAndDo(const char *query, UVPGParams *params, int resultFormat, void *data, uvpg_rows_cb rows_cb, uvpg_result_cb done_cb, uvpg_result_cb failure_cb=NULL, const uvpg_query_opts *opts=NULL);
+	// COPY ... FROM STDIN, see UVPGCopy.h.  write_cb is called once the server is ready for data,
+	// and again every time a backlog has been sent; done_cb gets the connection after end(),
+	// to PQgetResult() the outcome and return it.  failure_cb (or done_cb) gets it, or NULL if
+	// it never got a connection, when the COPY doesn't start or the connection fails.
+	void copyIn(const char *query, void *data, uvpg_copy_cb write_cb, uvpg_result_cb done_cb, uvpg_result_cb failure_cb=NULL, const uvpg_query_opts *opts=NULL);
+	// COPY ... TO STDOUT, see UVPGCopy.h.  data_cb gets the data as it comes in, and can pause()
+	// and resume() the copy; done_cb and failure_cb work the same as for copyIn().
+	void copyOut(const char *query, void *data, uvpg_copy_data_cb data_cb, uvpg_result_cb done_cb, uvpg_result_cb failure_cb=NULL, const uvpg_query_opts *opts=NULL);
+	// sendQueryAndDo() and the rest above belong on the loop's thread.  submitQuery() can be
+	// called from any thread: the query (parameters copied) goes on a lock-free queue, and the
+	// loop picks up everything queued each time submit_msg wakes it.  callback and failure_cb
+	// then run on the pool's loop, the same as for sendQueryAndDo().
+	void submitQuery(const char *query, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL, const uvpg_query_opts *opts=NULL);
+	// same, but the result comes back on another loop: the pool takes the query's PGresult,
+	// returns the connection itself, and 'replies' runs callback(result, data) on its own loop.
+	void submitQuery(const char *query, const uvpg_param_arrays &params, int resultFormat, UVPGReplyQueue *replies, void *data, uvpg_reply_cb callback, const uvpg_query_opts *opts=NULL);
+	// same, for a query already built (with new), which the pool takes over.
+	void submitQuery(UVPGQuery *pgquery);
+	void dispatchSubmitted();
+	// (loop thread only) takes the oldest query still waiting for a connection back out of
+	// the queue, for another pool to run (see UVPGShardedPool), or NULL.  Only if it was sent
+	// with 'callback', so the caller knows what its userdata is, and never streams or COPYs,
+	// which are tied to this pool.  What's left of its deadline is in timeout_ms.
+	UVPGQuery *stealQueued(uvpg_result_cb callback);
+	unsigned pendingCount() { return pending_count.load(); }
+	unsigned availableCount() { return available_count.load(); }
 	void checkQueuedRequests();
 };
 
@@ -0,0 +1,385 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+//
+//  UVPGResult.cpp
+//  UVPGPool
+//
+
+#include "UVPGResult.h"
+#include "UVPGParams.h"
+#include "byteorder_endian.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// every PostgreSQL binary value is big endian, and not necessarily aligned.
+static inline uint16_t uvpg_read16(const char *data)
+{
+	uint16_t value;
+	memcpy(&value, data, sizeof(value));
+	return be16toh(value);
+}
+static inline uint32_t uvpg_read32(const char *data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return be32toh(value);
+}
+static inline uint64_t uvpg_read64(const char *data)
+{
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return be64toh(value);
+}
+
+// decoders for a single value, shared by columns and array elements.
+static bool uvpg_decode(const char *data, int length, Oid oid, int format, int64_t &value)
+{
+	if(format == FORMAT_TEXT)
+	{
+		char *end;
+		value = strtoll(data, &end, 10);
+		return end != data && *end == '\0';
+	}
+	switch(oid)
+	{
+		case INT2OID:
+			if(length != 2) return false;
+			value = (int16_t)uvpg_read16(data);
+			return true;
+		case INT4OID:
+			if(length != 4) return false;
+			value = (int32_t)uvpg_read32(data);
+			return true;
+		case INT8OID:
+			if(length != 8) return false;
+			value = (int64_t)uvpg_read64(data);
+			return true;
+		default:
+			return false;
+	}
+}
+static bool uvpg_decode(const char *data, int length, Oid oid, int format, int32_t &value)
+{
+	int64_t wide;
+	if(!uvpg_decode(data, length, oid, format, wide) || wide < INT32_MIN || wide > INT32_MAX)
+		return false;
+	value = (int32_t)wide;
+	return true;
+}
+static bool uvpg_decode(const char *data, int length, Oid oid, int format, int16_t &value)
+{
+	int64_t wide;
+	if(!uvpg_decode(data, length, oid, format, wide) || wide < INT16_MIN || wide > INT16_MAX)
+		return false;
+	value = (int16_t)wide;
+	return true;
+}
+
+static bool uvpg_decode_numeric(const char *data, int length, double &value)
+{
+	// ndigits, weight, sign, dscale, then ndigits base 10000 digits, most significant first.
+	if(length < 8)
+		return false;
+	int ndigits = (int16_t)uvpg_read16(data);
+	int weight = (int16_t)uvpg_read16(data + 2);
+	uint16_t sign = uvpg_read16(data + 4);
+	if(length < 8 + ndigits * 2)
+		return false;
+	switch(sign)
+	{
+		case 0xC000: value = NAN; return true;
+		case 0xD000: value = INFINITY; return true;
+		case 0xF000: value = -INFINITY; return true;
+	}
+	double result = 0;
+	for(int ix = 0; ix < ndigits; ++ix)
+		result = result * 10000 + uvpg_read16(data + 8 + ix * 2);
+	result *= pow(10000.0, weight - ndigits + 1);
+	value = (sign == 0x4000) ? -result : result;
+	return true;
+}
+static bool uvpg_decode(const char *data, int length, Oid oid, int format, double &value)
+{
+	if(format == FORMAT_TEXT)
+	{
+		char *end;
+		value = strtod(data, &end);
+		return end != data && *end == '\0';
+	}
+	switch(oid)
+	{
+		case FLOAT4OID:
+		{
+			if(length != 4) return false;
+			uint32_t bits = uvpg_read32(data);
+			float fval;
+			memcpy(&fval, &bits, sizeof(fval));
+			value = fval;
+			return true;
+		}
+		case FLOAT8OID:
+		{
+			if(length != 8) return false;
+			uint64_t bits = uvpg_read64(data);
+			memcpy(&value, &bits, sizeof(value));
+			return true;
+		}
+		case NUMERICOID:
+			return uvpg_decode_numeric(data, length, value);
+		default:
+		{
+			int64_t ival;
+			if(!uvpg_decode(data, length, oid, format, ival))
+				return false;
+			value = (double)ival;
+			return true;
+		}
+	}
+}
+static bool uvpg_decode(const char *data, int length, Oid oid, int format, float &value)
+{
+	double dval;
+	if(format == FORMAT_BINARY && oid == FLOAT8OID)
+		return false; // would lose precision quietly.
+	if(!uvpg_decode(data, length, oid, format, dval))
+		return false;
+	value = (float)dval;
+	return true;
+}
+static bool uvpg_decode(const char *data, int length, Oid oid, int format, bool &value)
+{
+	if(format == FORMAT_TEXT)
+	{
+		if(data[0] != 't' && data[0] != 'f')
+			return false;
+		value = data[0] == 't';
+		return true;
+	}
+	if(oid != BOOLOID || length != 1)
+		return false;
+	value = data[0] != 0;
+	return true;
+}
+static bool uvpg_decode(const char *data, int length, Oid, int, uvpg_bytes &value)
+{
+	value.data = data;
+	value.length = length;
+	return true;
+}
+
+//
+// UVPGResult
+//
+
+UVPGResult::UVPGResult(PGresult *in_result)
+: result(in_result), row_count(0)
+{
+	if(result == NULL)
+		return;
+	row_count = PQntuples(result);
+	int count = PQnfields(result);
+	column_types.resize(count);
+	column_formats.resize(count);
+	for(int ix = 0; ix < count; ++ix)
+	{
+		column_types[ix] = PQftype(result, ix);
+		column_formats[ix] = PQfformat(result, ix);
+	}
+}
+
+bool UVPGResult::raw(int row, int col, const char **data, int *length)
+{
+	if(row < 0 || row >= row_count || col < 0 || col >= (int)column_types.size())
+		return false;
+	if(PQgetisnull(result, row, col))
+		return false;
+	*data = PQgetvalue(result, row, col);
+	*length = PQgetlength(result, row, col);
+	return true;
+}
+
+bool UVPGResult::get(int row, int col, int16_t &value)
+{
+	const char *data;
+	int length;
+	return raw(row, col, &data, &length) && uvpg_decode(data, length, column_types[col], column_formats[col], value);
+}
+bool UVPGResult::get(int row, int col, int32_t &value)
+{
+	const char *data;
+	int length;
+	return raw(row, col, &data, &length) && uvpg_decode(data, length, column_types[col], column_formats[col], value);
+}
+bool UVPGResult::get(int row, int col, int64_t &value)
+{
+	const char *data;
+	int length;
+	return raw(row, col, &data, &length) && uvpg_decode(data, length, column_types[col], column_formats[col], value);
+}
+bool UVPGResult::get(int row, int col, float &value)
+{
+	const char *data;
+	int length;
+	return raw(row, col, &data, &length) && uvpg_decode(data, length, column_types[col], column_formats[col], value);
+}
+bool UVPGResult::get(int row, int col, double &value)
+{
+	const char *data;
+	int length;
+	return raw(row, col, &data, &length) && uvpg_decode(data, length, column_types[col], column_formats[col], value);
+}
+bool UVPGResult::get(int row, int col, bool &value)
+{
+	const char *data;
+	int length;
+	return raw(row, col, &data, &length) && uvpg_decode(data, length, column_types[col], column_formats[col], value);
+}
+bool UVPGResult::get(int row, int col, const char *&value)
+{
+	const char *data;
+	int length;
+	if(!raw(row, col, &data, &length))
+		return false;
+	Oid oid = column_types[col];
+	if(column_formats[col] == FORMAT_BINARY && oid != TEXTOID && oid != VARCHAROID && oid != BPCHAROID &&
+	   oid != NAMEOID && oid != JSONOID && oid != XMLOID && oid != UNKNOWNOID)
+		return false;
+	value = data;
+	return true;
+}
+bool UVPGResult::get(int row, int col, uvpg_bytes &value)
+{
+	const char *data;
+	int length;
+	return raw(row, col, &data, &length) && uvpg_decode(data, length, column_types[col], column_formats[col], value);
+}
+bool UVPGResult::get(int row, int col, uvpg_uuid &value)
+{
+	const char *data;
+	int length;
+	if(!raw(row, col, &data, &length))
+		return false;
+	if(column_formats[col] != FORMAT_BINARY || column_types[col] != UUIDOID || length != 16)
+		return false;
+	memcpy(value.bytes, data, 16);
+	return true;
+}
+bool UVPGResult::get(int row, int col, uvpg_timestamp &value)
+{
+	const char *data;
+	int length;
+	if(!raw(row, col, &data, &length))
+		return false;
+	Oid oid = column_types[col];
+	if(column_formats[col] != FORMAT_BINARY || (oid != TIMESTAMPOID && oid != TIMESTAMPTZOID) || length != 8)
+		return false;
+	value.usec = (int64_t)uvpg_read64(data);
+	return true;
+}
+
+// walks a binary array: ndim, has-nulls flag, element type, (size, lower bound) per dimension,
+// then (length, data) per element, with a length of -1 for NULL.
+template<class _T>
+static bool uvpg_decode_array(const char *data, int length, std::vector<_T> &value)
+{
+	value.clear();
+	if(length < 12)
+		return false;
+	int ndim = (int32_t)uvpg_read32(data);
+	Oid element_oid = uvpg_read32(data + 8);
+	if(ndim < 0 || length < 12 + ndim * 8)
+		return false;
+	size_t count = ndim > 0 ? 1 : 0;
+	for(int ix = 0; ix < ndim; ++ix)
+		count *= (int32_t)uvpg_read32(data + 12 + ix * 8);
+	value.reserve(count);
+	
+	const char *pos = data + 12 + ndim * 8;
+	const char *end = data + length;
+	for(size_t ix = 0; ix < count; ++ix)
+	{
+		if(end - pos < 4)
+			return false;
+		int element_length = (int32_t)uvpg_read32(pos);
+		pos += 4;
+		_T element;
+		if(element_length < 0)
+		{
+			if(!uvpg_decode(NULL, -1, element_oid, FORMAT_BINARY, element))
+				return false;
+		}
+		else
+		{
+			if(end - pos < element_length ||
+			   !uvpg_decode(pos, element_length, element_oid, FORMAT_BINARY, element))
+				return false;
+			pos += element_length;
+		}
+		value.push_back(element);
+	}
+	return true;
+}
+
+#define UVPG_ARRAY_GET(_T) \
+bool UVPGResult::get(int row, int col, std::vector<_T> &value) \
+{ \
+	const char *data; \
+	int length; \
+	value.clear(); \
+	if(!raw(row, col, &data, &length) || column_formats[col] != FORMAT_BINARY) \
+		return false; \
+	return uvpg_decode_array(data, length, value); \
+}
+UVPG_ARRAY_GET(int16_t)
+UVPG_ARRAY_GET(int32_t)
+UVPG_ARRAY_GET(int64_t)
+UVPG_ARRAY_GET(float)
+UVPG_ARRAY_GET(double)
+UVPG_ARRAY_GET(uvpg_bytes)
+#undef UVPG_ARRAY_GET
+
+bool UVPGResult::get(int row, int col, std::vector<bool> &value)
+{
+	// std::vector<bool> being what it is, decode element by element.
+	std::vector<uvpg_bytes> elements;
+	value.clear();
+	if(!get(row, col, elements))
+		return false;
+	value.reserve(elements.size());
+	for(size_t ix = 0; ix < elements.size(); ++ix)
+	{
+		if(elements[ix].data == NULL || elements[ix].length != 1)
+			return false;
+		value.push_back(elements[ix].data[0] != 0);
+	}
+	return true;
+}
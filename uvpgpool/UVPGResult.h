@@ -0,0 +1,125 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+//
+//  UVPGResult.h
+//  UVPGPool
+//
+
+#ifndef __UVPGResult__
+#define __UVPGResult__
+
+#include "uvpg_pgtypes.h"
+
+#include <vector>
+#include <libpq-fe.h>
+#include <stdint.h>
+#include <time.h>
+
+// a value's bytes, straight out of the PGresult (so only good for as long as the result is).
+class uvpg_bytes
+{
+public:
+	uvpg_bytes() : data(NULL), length(0) { };
+	const char *data;
+	int length;
+};
+
+class uvpg_uuid
+{
+public:
+	uint8_t bytes[16];
+};
+
+// timestamp/timestamptz: microseconds since 2000-01-01 00:00:00 (UTC, for timestamptz).
+class uvpg_timestamp
+{
+public:
+	uvpg_timestamp() : usec(0) { };
+	int64_t usec;
+	
+	time_t unixTime() const { return (time_t)(usec / 1000000 + 946684800); }
+};
+
+// reads values out of a PGresult without going through text: binary columns (resultFormat 1)
+// are decoded by type, straight from libpq's buffer.  Text columns still work for text and
+// numbers, parsed in place.  get() returns false for NULLs and for types which don't fit
+// (or would lose range); integers widen, and anything numeric reads as a double.
+// Column types are looked up once, when the reader is created, and column() resolves a name
+// to an index, which is worth doing once per result rather than per row.
+class UVPGResult
+{
+private:
+	PGresult *result;
+	int row_count;
+	std::vector<Oid> column_types;
+	std::vector<int> column_formats;
+	
+	bool raw(int row, int col, const char **data, int *length);
+	
+public:
+	UVPGResult(PGresult *in_result);
+	
+	int rows() { return row_count; }
+	int cols() { return (int)column_types.size(); }
+	int column(const char *name) { return PQfnumber(result, name); } // -1 if there's no such column.
+	Oid type(int col) { return column_types[col]; }
+	bool isNull(int row, int col) { return PQgetisnull(result, row, col) != 0; }
+	
+	bool get(int row, int col, int16_t &value);
+	bool get(int row, int col, int32_t &value);
+	bool get(int row, int col, int64_t &value);
+	bool get(int row, int col, float &value);
+	bool get(int row, int col, double &value); // also NUMERIC, which may round.
+	bool get(int row, int col, bool &value);
+	bool get(int row, int col, const char *&value); // text types, NUL terminated by libpq.
+	bool get(int row, int col, uvpg_bytes &value); // any type, raw; bytea in binary format.
+	bool get(int row, int col, uvpg_uuid &value);
+	bool get(int row, int col, uvpg_timestamp &value);
+	
+	// binary arrays, one dimensional (multi dimensional ones come out flattened).  A NULL element
+	// fails the whole thing, except for uvpg_bytes, where it comes back with NULL data.  Array
+	// elements aren't NUL terminated, so text arrays come back as uvpg_bytes.  The vector is
+	// cleared first; reusing one across rows saves reallocating it.
+	bool get(int row, int col, std::vector<int16_t> &value);
+	bool get(int row, int col, std::vector<int32_t> &value);
+	bool get(int row, int col, std::vector<int64_t> &value);
+	bool get(int row, int col, std::vector<float> &value);
+	bool get(int row, int col, std::vector<double> &value);
+	bool get(int row, int col, std::vector<bool> &value);
+	bool get(int row, int col, std::vector<uvpg_bytes> &value);
+	
+	template<class _T> bool get(int row, const char *name, _T &value)
+	{
+		int col = column(name);
+		return col >= 0 && get(row, col, value);
+	}
+};
+
+#endif /* defined(__UVPGResult__) */
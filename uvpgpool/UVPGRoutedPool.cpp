@@ -0,0 +1,259 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  UVPGRoutedPool.cpp
+//  UVPGPool
+//
+
+#include "UVPGRoutedPool.h"
+
+#include <stdlib.h>
+
+// replay lag in ms: nothing, if the replica has replayed everything it has received and is still
+// receiving (an idle primary means no new transactions to measure by), NULL if it isn't a replica
+// at all.  Without a WAL receiver, having replayed everything says nothing, so it's the time since
+// the last replayed transaction (or infinite, if there hasn't been one).  pg_stat_wal_receiver only
+// has a row while the receiver runs, and its pid shows without pg_read_all_stats.
+static const char *uvpg_lag_query =
+	"SELECT CASE WHEN NOT pg_is_in_recovery() THEN NULL"
+	" WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn()"
+	" AND EXISTS (SELECT 1 FROM pg_stat_wal_receiver WHERE pid IS NOT NULL) THEN 0"
+	" ELSE COALESCE(EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp())::float8 * 1000, 'Infinity') END";
+
+// weight of the newest round-trip in UVPGEndpoint::latency_ms.
+#define UVPG_LATENCY_WEIGHT 0.2
+
+// a query on its way to an endpoint.
+struct uvpg_routed_query
+{
+	UVPGEndpoint *endpoint;
+	uint64_t started;
+	void *data;
+	uvpg_result_cb callback;
+	uvpg_result_cb failure_cb;
+};
+
+static void uvpg_routed_finished(uvpg_routed_query *query, uv_loop_t *loop)
+{
+	UVPGEndpoint *endpoint = query->endpoint;
+	double elapsed = (double)(uv_now(loop) - query->started);
+	endpoint->inflight--;
+	if(endpoint->queries++ == 0)
+		endpoint->latency_ms = elapsed;
+	else
+		endpoint->latency_ms += (elapsed - endpoint->latency_ms) * UVPG_LATENCY_WEIGHT;
+}
+
+static void uvpg_routed_result(PGconn *conn, void *data)
+{
+	uvpg_routed_query *query = (uvpg_routed_query *)data;
+	uvpg_routed_finished(query, query->endpoint->pool->getLoop());
+	query->callback(conn, query->data);
+	delete query;
+}
+
+static void uvpg_routed_failed(PGconn *conn, void *data)
+{
+	uvpg_routed_query *query = (uvpg_routed_query *)data;
+	uvpg_routed_finished(query, query->endpoint->pool->getLoop());
+	if(query->failure_cb)
+		query->failure_cb(conn, query->data);
+	else
+		query->callback(conn, query->data);
+	delete query;
+}
+
+static void uvpg_probe_tick(uv_timer_t *timer, int status)
+{
+	UVPGRoutedPool *router = (UVPGRoutedPool *)timer->data;
+	router->probe();
+}
+
+static void uvpg_probe_result(PGconn *conn, void *data)
+{
+	UVPGEndpoint *endpoint = (UVPGEndpoint *)data;
+	endpoint->router->probeDone(endpoint, conn);
+}
+
+static void uvpg_probe_failed(PGconn *conn, void *data)
+{
+	UVPGEndpoint *endpoint = (UVPGEndpoint *)data;
+	endpoint->router->probeFailed(endpoint, conn);
+}
+
+UVPGRoutedPool::UVPGRoutedPool(uv_loop_t *loop, unsigned in_min_connections, unsigned in_min_free_connections, unsigned in_max_connections, unsigned in_max_free_connections)
+: eventloop(loop), primary_endpoint(NULL),
+  min_connections(in_min_connections), min_free_connections(in_min_free_connections),
+  max_connections(in_max_connections), max_free_connections(in_max_free_connections),
+  probe_interval_ms(UVPG_PROBE_INTERVAL_MS), max_lag_ms(UVPG_MAX_REPLICA_LAG_MS),
+  endpoint_cb(NULL), endpoint_data(NULL)
+{
+	uv_timer_init(eventloop, &probe_timer);
+	probe_timer.data = this;
+}
+
+UVPGRoutedPool::~UVPGRoutedPool()
+{
+	uv_timer_stop(&probe_timer);
+	for(size_t ix = 0; ix < endpoints.size(); ++ix)
+	{
+		delete endpoints[ix]->pool;
+		delete endpoints[ix];
+	}
+}
+
+UVPGEndpoint *UVPGRoutedPool::addEndpoint(const char *connstring, int role)
+{
+	UVPGEndpoint *endpoint = new UVPGEndpoint;
+	endpoint->router = this;
+	endpoint->index = (unsigned)endpoints.size();
+	endpoint->role = role;
+	endpoint->pool = new UVPGPool(eventloop, connstring, min_connections, min_free_connections, max_connections, max_free_connections);
+	endpoints.push_back(endpoint);
+	if(role == UVPGEndpoint::primary)
+	{
+		endpoint->healthy = true;
+		primary_endpoint = endpoint;
+	}
+	else if(!uv_is_active((uv_handle_t *)&probe_timer))
+	{
+		// first probe right away, so reads don't wait a whole interval for a replica.
+		uv_timer_start(&probe_timer, uvpg_probe_tick, 0, probe_interval_ms);
+	}
+	return endpoint;
+}
+
+void UVPGRoutedPool::setProbeInterval(unsigned ms)
+{
+	probe_interval_ms = ms > 0 ? ms : UVPG_PROBE_INTERVAL_MS;
+	if(uv_is_active((uv_handle_t *)&probe_timer))
+		uv_timer_start(&probe_timer, uvpg_probe_tick, probe_interval_ms, probe_interval_ms);
+}
+
+UVPGEndpoint *UVPGRoutedPool::route(bool read_only)
+{
+	if(!read_only)
+		return primary_endpoint;
+	UVPGEndpoint *best = NULL;
+	for(size_t ix = 0; ix < endpoints.size(); ++ix)
+	{
+		UVPGEndpoint *endpoint = endpoints[ix];
+		if(endpoint->role != UVPGEndpoint::replica || !endpoint->healthy)
+			continue;
+		if(best == NULL || endpoint->inflight < best->inflight ||
+		   (endpoint->inflight == best->inflight && endpoint->latency_ms < best->latency_ms))
+			best = endpoint;
+	}
+	return best ? best : primary_endpoint;
+}
+
+void UVPGRoutedPool::sendQueryAndDo(const char *query, UVPGParams *params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb, const uvpg_query_opts *opts)
+{
+	sendQueryAndDo(query, params->arrays(), resultFormat, data, callback, failure_cb, opts);
+}
+
+void UVPGRoutedPool::sendQueryAndDo(const char *query, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb, const uvpg_query_opts *opts)
+{
+	UVPGEndpoint *endpoint = route(opts && opts->read_only);
+	if(endpoint == NULL)
+	{
+		printf("No primary endpoint to send query to.\n");
+		(failure_cb ? failure_cb : callback)(NULL, data);
+		return;
+	}
+	uvpg_routed_query *routed = new uvpg_routed_query;
+	routed->endpoint = endpoint;
+	routed->started = uv_now(eventloop);
+	routed->data = data;
+	routed->callback = callback;
+	routed->failure_cb = failure_cb;
+	endpoint->inflight++;
+	endpoint->pool->sendQueryAndDo(query, params, resultFormat, routed, uvpg_routed_result, uvpg_routed_failed, opts);
+}
+
+void UVPGRoutedPool::returnConnection(PGconn *conn)
+{
+	UVPGPool *pool = UVPGPool::poolOf(conn);
+	if(pool == NULL)
+	{
+		printf("Connection returned to routed pool isn't one of ours.\n");
+		return;
+	}
+	pool->returnConnection(conn);
+}
+
+void UVPGRoutedPool::probe()
+{
+	uvpg_query_opts opts;
+	opts.timeout_ms = probe_interval_ms;
+	for(size_t ix = 0; ix < endpoints.size(); ++ix)
+	{
+		UVPGEndpoint *endpoint = endpoints[ix];
+		if(endpoint->role != UVPGEndpoint::replica || endpoint->probing)
+			continue;
+		endpoint->probing = true;
+		endpoint->pool->sendQueryAndDo(uvpg_lag_query, uvpg_param_arrays(), FORMAT_TEXT, endpoint, uvpg_probe_result, uvpg_probe_failed, &opts);
+	}
+}
+
+void UVPGRoutedPool::probeDone(UVPGEndpoint *endpoint, PGconn *conn)
+{
+	endpoint->probing = false;
+	PGresult *result = conn ? PQgetResult(conn) : NULL;
+	bool healthy = false;
+	if(result && PQresultStatus(result) == PGRES_TUPLES_OK && PQntuples(result) == 1)
+	{
+		// NULL: not in recovery, so not behind anything.
+		endpoint->lag_ms = PQgetisnull(result, 0, 0) ? 0 : atof(PQgetvalue(result, 0, 0));
+		healthy = endpoint->lag_ms <= max_lag_ms;
+	}
+	setHealthy(endpoint, healthy);
+	PQclear(result);
+	if(conn)
+		endpoint->pool->returnConnection(conn);
+}
+
+void UVPGRoutedPool::probeFailed(UVPGEndpoint *endpoint, PGconn *conn)
+{
+	// timed out (the probe is still running, being cancelled) or never got a connection.
+	// Either way, don't read from it: PQgetResult() would wait on the socket, and stall the loop.
+	endpoint->probing = false;
+	setHealthy(endpoint, false);
+	if(conn)
+		endpoint->pool->returnConnection(conn);
+}
+
+void UVPGRoutedPool::setHealthy(UVPGEndpoint *endpoint, bool healthy)
+{
+	if(endpoint->healthy == healthy)
+		return;
+	endpoint->healthy = healthy;
+	if(endpoint_cb)
+		endpoint_cb(this, endpoint, endpoint_data);
+}
@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  UVPGRoutedPool.h
+//  UVPGPool
+//
+
+#ifndef __UVPGRoutedPool__
+#define __UVPGRoutedPool__
+
+#include "UVPGPool.h"
+
+#include <vector>
+
+class UVPGRoutedPool;
+class UVPGEndpoint;
+
+// a replica started or stopped taking reads (see UVPGEndpoint::healthy).
+typedef void (*uvpg_endpoint_cb)(UVPGRoutedPool *router, const UVPGEndpoint *endpoint, void *data);
+
+// one server, with a UVPGPool of its own.
+class UVPGEndpoint
+{
+public:
+	enum { primary, replica };
+	
+	UVPGEndpoint() : pool(NULL), router(NULL), index(0), role(primary), healthy(false), probing(false),
+		lag_ms(0), latency_ms(0), inflight(0), queries(0) { };
+	UVPGPool *pool;
+	UVPGRoutedPool *router;
+	unsigned index; // in the order they were added.
+	int role;
+	bool healthy; // replicas: answered the last lag probe, and weren't too far behind.
+	bool probing;
+	double lag_ms; // replicas: replay lag at the last probe.
+	double latency_ms; // moving average of query round-trips.
+	unsigned inflight; // sent and not called back yet.
+	uint64_t queries;
+};
+
+// how often replicas are asked for their lag, in ms, and how far behind they can be
+// before reads stop going to them.
+#define UVPG_PROBE_INTERVAL_MS 1000
+#define UVPG_MAX_REPLICA_LAG_MS 5000
+
+// a primary and any number of replicas, each with its own UVPGPool on the same loop.
+// Queries go to the primary, unless opts->read_only is set: those go to the healthy
+// replica with the fewest queries in flight (the lowest latency, if that's a tie), or
+// the primary if no replica is healthy.  Replicas are only healthy once they've answered a
+// lag probe (pg_last_xact_replay_timestamp()), and stop being so as soon as a probe fails
+// or shows them more than max_lag_ms behind.
+//
+// Loop thread only, like UVPGPool.  Callbacks are the same as for UVPGPool::sendQueryAndDo(),
+// and returnConnection() hands a connection back to whichever pool it came from.
+class UVPGRoutedPool
+{
+private:
+	uv_loop_t *eventloop;
+	uv_timer_t probe_timer;
+	std::vector<UVPGEndpoint *> endpoints;
+	UVPGEndpoint *primary_endpoint;
+	unsigned min_connections;
+	unsigned min_free_connections;
+	unsigned max_connections;
+	unsigned max_free_connections;
+	unsigned probe_interval_ms;
+	unsigned max_lag_ms;
+	uvpg_endpoint_cb endpoint_cb;
+	void *endpoint_data;
+	
+	UVPGEndpoint *route(bool read_only);
+	void setHealthy(UVPGEndpoint *endpoint, bool healthy);
+	
+public:
+	// connection counts are per endpoint.
+	UVPGRoutedPool(uv_loop_t *loop, unsigned min_connections, unsigned min_free_connections, unsigned max_connections, unsigned max_free_connections);
+	~UVPGRoutedPool();
+	
+	// connstring has to stay around, as for UVPGPool.  Exactly one primary.
+	UVPGEndpoint *addEndpoint(const char *connstring, int role);
+	void setProbeInterval(unsigned ms);
+	void setMaxReplicaLag(unsigned ms) { max_lag_ms = ms; }
+	// called whenever a probe changes a replica's health.  NULL (the default) for nothing.
+	void setEndpointCallback(uvpg_endpoint_cb callback, void *data) { endpoint_cb = callback; endpoint_data = data; }
+	size_t endpointCount() { return endpoints.size(); }
+	const UVPGEndpoint *endpoint(size_t ix) { return endpoints[ix]; }
+	
+	void sendQueryAndDo(const char *query, UVPGParams *params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL, const uvpg_query_opts *opts=NULL);
+	void sendQueryAndDo(const char *query, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_result_cb callback, uvpg_result_cb failure_cb=NULL, const uvpg_query_opts *opts=NULL);
+	void returnConnection(PGconn *conn);
+	
+	void probe();
+	void probeDone(UVPGEndpoint *endpoint, PGconn *conn);
+	void probeFailed(UVPGEndpoint *endpoint, PGconn *conn);
+};
+
+#endif /* defined(__UVPGRoutedPool__) */
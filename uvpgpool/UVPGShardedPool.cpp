@@ -0,0 +1,259 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  UVPGShardedPool.cpp
+//  UVPGPool
+//
+
+#include "UVPGShardedPool.h"
+
+// a query on its way through the shards: the caller's callback, and the shard it's charged
+// to, which changes if it gets stolen.
+struct uvpg_shard_query
+{
+	UVPGShard *shard;
+	void *data;
+	uvpg_reply_cb callback;
+	UVPGReplyQueue *replies;
+};
+
+static void uvpg_shard_deliver(uvpg_shard_query *query, PGresult *result)
+{
+	UVPGShard *shard = query->shard;
+	shard->inflight--;
+	shard->completed++;
+	if(query->replies)
+	{
+		uvpg_reply *reply = new uvpg_reply;
+		reply->pool = shard->pool;
+		reply->queue = query->replies;
+		reply->callback = query->callback;
+		reply->data = query->data;
+		reply->result = result;
+		reply->queue_next = NULL;
+		query->replies->post(reply);
+	}
+	else
+		query->callback(result, query->data);
+	delete query;
+}
+
+static void uvpg_shard_result(PGconn *conn, void *data)
+{
+	uvpg_shard_query *query = (uvpg_shard_query *)data;
+	PGresult *result = PQgetResult(conn);
+	query->shard->pool->returnConnection(conn);
+	uvpg_shard_deliver(query, result);
+}
+
+static void uvpg_shard_failed(PGconn *conn, void *data)
+{
+	uvpg_shard_query *query = (uvpg_shard_query *)data;
+	if(conn != NULL)
+		query->shard->pool->returnConnection(conn);
+	uvpg_shard_deliver(query, NULL);
+}
+
+static void uvpg_shard_thread(void *arg)
+{
+	UVPGShard *shard = (UVPGShard *)arg;
+	uv_run(&shard->loop, UV_RUN_DEFAULT);
+}
+
+static void uvpg_shard_balance(uv_timer_t *timer, int status)
+{
+	UVPGShard *shard = (UVPGShard *)timer->data;
+	shard->owner->balance(shard);
+}
+
+static void uvpg_shard_steal(uv_async_t *async, int status)
+{
+	UVPGShard *shard = (UVPGShard *)async->data;
+	shard->owner->giveWork(shard);
+}
+
+static void uvpg_shard_stop(uv_async_t *async, int status)
+{
+	UVPGShard *shard = (UVPGShard *)async->data;
+	uv_stop(&shard->loop);
+}
+
+UVPGShardedPool::UVPGShardedPool(const char *connstring, unsigned shard_count, unsigned min_connections, unsigned min_free_connections, unsigned max_connections, unsigned max_free_connections)
+: next_shard(0), running(false)
+{
+	if(shard_count == 0)
+		shard_count = 1;
+	for(unsigned ix = 0; ix < shard_count; ++ix)
+	{
+		// everything gets set up here, the threads only run the loops.
+		UVPGShard *shard = new UVPGShard;
+		shard->owner = this;
+		shard->index = ix;
+		uv_loop_init(&shard->loop);
+		shard->pool = new UVPGPool(&shard->loop, connstring, min_connections, min_free_connections, max_connections, max_free_connections);
+		uv_async_init(&shard->loop, &shard->steal_msg, uvpg_shard_steal);
+		shard->steal_msg.data = shard;
+		uv_async_init(&shard->loop, &shard->stop_msg, uvpg_shard_stop);
+		shard->stop_msg.data = shard;
+		uv_timer_init(&shard->loop, &shard->balance_timer);
+		shard->balance_timer.data = shard;
+		shards.push_back(shard);
+	}
+}
+
+UVPGShardedPool::~UVPGShardedPool()
+{
+	stop();
+	for(size_t ix = 0; ix < shards.size(); ++ix)
+	{
+		delete shards[ix]->pool;
+		delete shards[ix];
+	}
+}
+
+void UVPGShardedPool::start()
+{
+	if(running)
+		return;
+	running = true;
+	for(size_t ix = 0; ix < shards.size(); ++ix)
+	{
+		UVPGShard *shard = shards[ix];
+		uv_timer_start(&shard->balance_timer, uvpg_shard_balance, UVPG_SHARD_BALANCE_MS, UVPG_SHARD_BALANCE_MS);
+		uv_thread_create(&shard->thread, uvpg_shard_thread, shard);
+	}
+}
+
+void UVPGShardedPool::stop()
+{
+	if(!running)
+		return;
+	running = false;
+	for(size_t ix = 0; ix < shards.size(); ++ix)
+		uv_async_send(&shards[ix]->stop_msg);
+	for(size_t ix = 0; ix < shards.size(); ++ix)
+		uv_thread_join(&shards[ix]->thread);
+}
+
+UVPGShard *UVPGShardedPool::leastLoaded()
+{
+	// starting somewhere different every time, so ties don't all land on the first shard.
+	size_t count = shards.size();
+	size_t start = next_shard++ % count;
+	UVPGShard *best = shards[start];
+	unsigned best_load = best->inflight.load();
+	for(size_t ix = 1; ix < count && best_load > 0; ++ix)
+	{
+		UVPGShard *shard = shards[(start + ix) % count];
+		unsigned load = shard->inflight.load();
+		if(load < best_load)
+		{
+			best = shard;
+			best_load = load;
+		}
+	}
+	return best;
+}
+
+void UVPGShardedPool::submitQuery(const char *query, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_reply_cb callback, const uvpg_query_opts *opts, UVPGReplyQueue *replies)
+{
+	UVPGShard *shard = leastLoaded();
+	uvpg_shard_query *shard_query = new uvpg_shard_query;
+	shard_query->shard = shard;
+	shard_query->data = data;
+	shard_query->callback = callback;
+	shard_query->replies = replies;
+	shard->inflight++;
+	shard->submitted++;
+	shard->pool->submitQuery(query, params, resultFormat, shard_query, uvpg_shard_result, uvpg_shard_failed, opts);
+}
+
+void UVPGShardedPool::balance(UVPGShard *shard)
+{
+	// only an idle shard goes looking: nothing queued, and connections to spare.
+	if(shard->pool->pendingCount() > 0 || shard->pool->availableCount() == 0)
+		return;
+	UVPGShard *victim = NULL;
+	unsigned most = 0;
+	for(size_t ix = 0; ix < shards.size(); ++ix)
+	{
+		unsigned queued = shards[ix]->pool->pendingCount();
+		if(shards[ix] != shard && queued > most)
+		{
+			victim = shards[ix];
+			most = queued;
+		}
+	}
+	if(victim == NULL)
+		return;
+	// one thief at a time; if someone beat us to it, there's always next time.
+	int expected = -1;
+	if(victim->thief.compare_exchange_strong(expected, (int)shard->index))
+		uv_async_send(&victim->steal_msg);
+}
+
+void UVPGShardedPool::giveWork(UVPGShard *shard)
+{
+	int thief_index = shard->thief.exchange(-1);
+	if(thief_index < 0)
+		return;
+	UVPGShard *thief = shards[thief_index];
+	// half of what's waiting, but no more than the thief has connections for.
+	unsigned count = (shard->pool->pendingCount() + 1) / 2;
+	unsigned available = thief->pool->availableCount();
+	if(count > available)
+		count = available > 0 ? available : 1;
+	while(count-- > 0)
+	{
+		UVPGQuery *pgquery = shard->pool->stealQueued(uvpg_shard_result);
+		if(pgquery == NULL)
+			break;
+		uvpg_shard_query *shard_query = (uvpg_shard_query *)pgquery->userdata;
+		shard_query->shard = thief;
+		shard->inflight--;
+		thief->inflight++;
+		shard->stolen_out++;
+		thief->stolen_in++;
+		thief->pool->submitQuery(pgquery);
+	}
+}
+
+uvpg_shard_stats UVPGShardedPool::stats(unsigned index)
+{
+	UVPGShard *shard = shards[index];
+	uvpg_shard_stats stats;
+	stats.submitted = shard->submitted.load();
+	stats.completed = shard->completed.load();
+	stats.stolen_in = shard->stolen_in.load();
+	stats.stolen_out = shard->stolen_out.load();
+	stats.inflight = shard->inflight.load();
+	stats.queued = shard->pool->pendingCount();
+	stats.available = shard->pool->availableCount();
+	return stats;
+}
@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  UVPGShardedPool.h
+//  UVPGPool
+//
+
+#ifndef __UVPGShardedPool__
+#define __UVPGShardedPool__
+
+#include "UVPGPool.h"
+
+#include <atomic>
+#include <vector>
+
+class UVPGShardedPool;
+
+// what a shard has been up to.  submitted/completed/stolen_* count up from start();
+// the rest is how things stand right now.
+class uvpg_shard_stats
+{
+public:
+	uint64_t submitted; // routed to this shard.
+	uint64_t completed; // callbacks run on this shard, stolen queries included.
+	uint64_t stolen_in; // taken from other shards' queues.
+	uint64_t stolen_out; // taken by other shards.
+	unsigned inflight; // submitted (or stolen) and not called back yet.
+	unsigned queued; // waiting for a connection.
+	unsigned available; // idle connections.
+};
+
+// one loop, its thread and the UVPGPool on it.
+class UVPGShard
+{
+public:
+	UVPGShard() : owner(NULL), index(0), pool(NULL), thief(-1), inflight(0),
+		submitted(0), completed(0), stolen_in(0), stolen_out(0) { };
+	UVPGShardedPool *owner;
+	unsigned index;
+	uv_loop_t loop;
+	uv_thread_t thread;
+	UVPGPool *pool;
+	uv_async_t steal_msg; // thief has asked for some of our queue.
+	uv_async_t stop_msg;
+	uv_timer_t balance_timer;
+	std::atomic<int> thief; // shard waiting on steal_msg, -1 if none.
+	std::atomic<unsigned> inflight;
+	std::atomic<uint64_t> submitted;
+	std::atomic<uint64_t> completed;
+	std::atomic<uint64_t> stolen_in;
+	std::atomic<uint64_t> stolen_out;
+};
+
+// how often an idle shard looks for someone to steal from, in ms.
+#define UVPG_SHARD_BALANCE_MS 5
+
+// N UVPGPools, each on a loop and thread of its own, so result handling and callbacks
+// spread over as many cores.  Queries can be submitted from any thread; each goes to the
+// shard with the fewest queries in flight.  A shard with idle connections and nothing
+// queued takes half the queue of the most backed up shard.
+//
+// Callbacks get the query's result (yours to PQclear(), NULL if the query failed or timed
+// out) on whichever shard's loop ran it, or on 'replies' loop if one is given.  The pool
+// returns the connections itself.
+class UVPGShardedPool
+{
+private:
+	std::vector<UVPGShard *> shards;
+	std::atomic<unsigned> next_shard; // where the least loaded search starts, round robin.
+	bool running;
+	
+	UVPGShard *leastLoaded();
+	
+public:
+	// connection counts are per shard.
+	UVPGShardedPool(const char *connstring, unsigned shard_count, unsigned min_connections, unsigned min_free_connections, unsigned max_connections, unsigned max_free_connections);
+	~UVPGShardedPool();
+	
+	// configure the pools (setPipelineDepth() and the like) before start(), not after.
+	unsigned shardCount() { return (unsigned)shards.size(); }
+	UVPGPool *shardPool(unsigned shard) { return shards[shard]->pool; }
+	void start();
+	void stop(); // waits for the threads.  Anything still in flight is dropped.
+	
+	void submitQuery(const char *query, const uvpg_param_arrays &params, int resultFormat, void *data, uvpg_reply_cb callback, const uvpg_query_opts *opts=NULL, UVPGReplyQueue *replies=NULL);
+	uvpg_shard_stats stats(unsigned shard);
+	
+	// (shard threads only)
+	void balance(UVPGShard *shard);
+	void giveWork(UVPGShard *shard);
+};
+
+#endif /* defined(__UVPGShardedPool__) */
@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  UVPGSubmitQueue.h
+//  UVPGPool
+//
+
+#ifndef __UVPGSubmitQueue__
+#define __UVPGSubmitQueue__
+
+#include <atomic>
+#include <stddef.h>
+
+// lock-free multiple producer, single consumer queue, linked through the items themselves
+// (T needs a 'T *queue_next').  Any thread can push(); only one thread takes items off, all
+// of them at once, oldest first.  Nothing is ever popped singly, so there's no ABA to worry
+// about: push is a compare-and-swap loop, popAll a single exchange.
+template<class T>
+class UVPGSubmitQueue
+{
+private:
+	std::atomic<T *> head; // newest first.
+	
+public:
+	UVPGSubmitQueue() : head(NULL) { };
+	
+	// returns true if the queue was empty, i.e. the consumer may need waking.  If it wasn't,
+	// whoever pushed onto the empty queue has already done that.
+	bool push(T *item)
+	{
+		T *oldhead = head.load();
+		do
+		{
+			item->queue_next = oldhead;
+		} while(!head.compare_exchange_weak(oldhead, item));
+		return oldhead == NULL;
+	};
+	
+	// everything pushed so far, as a list in push order.  Consumer only.
+	T *popAll()
+	{
+		T *item = head.exchange(NULL);
+		T *list = NULL;
+		while(item != NULL)
+		{
+			T *next = item->queue_next;
+			item->queue_next = list;
+			list = item;
+			item = next;
+		}
+		return list;
+	};
+	
+	bool empty() { return head.load() == NULL; };
+};
+
+#endif /* defined(__UVPGSubmitQueue__) */
@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  UVPGTimerWheel.cpp
+//  UVPGPool
+//
+
+#include "UVPGTimerWheel.h"
+
+void uvpg_timer_node::unlink()
+{
+	if(next == NULL)
+		return;
+	prev->next = next;
+	next->prev = prev;
+	prev = NULL;
+	next = NULL;
+	if(count)
+		(*count)--;
+	count = NULL;
+}
+
+UVPGTimerWheel::UVPGTimerWheel(unsigned in_slot_count, uint64_t in_tick_ms)
+: slot_count(in_slot_count), tick_ms(in_tick_ms), current_tick(0), armed_count(0)
+{
+	if(slot_count == 0)
+		slot_count = 1;
+	if(tick_ms == 0)
+		tick_ms = 1;
+	slots = new uvpg_timer_node[slot_count];
+	for(unsigned ix = 0; ix < slot_count; ++ix)
+	{
+		slots[ix].prev = &slots[ix];
+		slots[ix].next = &slots[ix];
+	}
+}
+UVPGTimerWheel::~UVPGTimerWheel()
+{
+	// let go of anything still waiting, so their owners don't reach back into freed slots.
+	for(unsigned ix = 0; ix < slot_count; ++ix)
+	{
+		while(slots[ix].next != &slots[ix])
+			slots[ix].next->unlink();
+		slots[ix].prev = NULL;
+		slots[ix].next = NULL;
+	}
+	delete [] slots;
+}
+
+void UVPGTimerWheel::add(uvpg_timer_node *node, uint64_t expires, uint64_t now)
+{
+	node->unlink();
+	if(empty())
+		current_tick = now / tick_ms;
+	node->expires = expires;
+	uint64_t tick = expires / tick_ms;
+	if(tick < current_tick)
+		tick = current_tick; // already due, the next advance() will get it.
+	uvpg_timer_node *slot = &slots[tick % slot_count];
+	node->prev = slot->prev;
+	node->next = slot;
+	slot->prev->next = node;
+	slot->prev = node;
+	node->count = &armed_count;
+	armed_count++;
+}
+
+void UVPGTimerWheel::advance(uint64_t now, uvpg_expire_cb callback, void *data)
+{
+	uint64_t target = now / tick_ms;
+	if(target < current_tick)
+		return;
+	uint64_t due = target - current_tick + 1;
+	if(due > slot_count)
+		due = slot_count; // been a while, every slot is due for a look.
+	
+	// pull everything that's due onto a list of our own first, since an expiry callback
+	// is free to destroy any other node (which unlinks it from wherever it is).
+	uvpg_timer_node expired;
+	expired.prev = &expired;
+	expired.next = &expired;
+	for(uint64_t ix = 0; ix < due; ++ix)
+	{
+		uvpg_timer_node *slot = &slots[(current_tick + ix) % slot_count];
+		uvpg_timer_node *node = slot->next;
+		while(node != slot)
+		{
+			uvpg_timer_node *next = node->next;
+			if(node->expires <= now)
+			{
+				node->unlink();
+				node->prev = expired.prev;
+				node->next = &expired;
+				expired.prev->next = node;
+				expired.prev = node;
+			}
+			node = next;
+		}
+	}
+	// the target tick may still have later deadlines in it, so it gets looked at again.
+	current_tick = target;
+	
+	while(expired.next != &expired)
+	{
+		uvpg_timer_node *node = expired.next;
+		node->unlink();
+		callback(node, data);
+	}
+	expired.prev = NULL;
+	expired.next = NULL;
+}
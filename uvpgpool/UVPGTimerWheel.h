@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+//
+//  UVPGTimerWheel.h
+//  UVPGPool
+//
+
+#ifndef __UVPGTimerWheel__
+#define __UVPGTimerWheel__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// something with a deadline.  Embedded in whatever owns the deadline, and takes itself off
+// the wheel when it's destroyed, so owners never need to remember to cancel it.
+class uvpg_timer_node
+{
+public:
+	uvpg_timer_node() : expires(0), owner(NULL), kind(0), prev(NULL), next(NULL), count(NULL) { };
+	~uvpg_timer_node() { unlink(); };
+	uint64_t expires; // uv_now() based, in ms.
+	void *owner;
+	int kind;
+	uvpg_timer_node *prev;
+	uvpg_timer_node *next;
+	size_t *count; // the wheel's count of armed nodes.
+	
+	bool armed() const { return next != NULL; };
+	void unlink();
+};
+
+typedef void (*uvpg_expire_cb)(uvpg_timer_node *node, void *data);
+
+// hashed timing wheel: deadlines go into slot (expires / tick) % slots, and each tick only
+// looks at the slot(s) that came due.  Adding and removing a deadline is O(1), which is the
+// point; precision is one tick.  Driving it (a uv timer calling advance()) is up to the owner.
+class UVPGTimerWheel
+{
+private:
+	uvpg_timer_node *slots; // sentinel of a circular list per slot.
+	unsigned slot_count;
+	uint64_t tick_ms;
+	uint64_t current_tick; // oldest tick which may still have something due.
+	size_t armed_count;
+	
+public:
+	UVPGTimerWheel(unsigned in_slot_count=256, uint64_t in_tick_ms=10);
+	~UVPGTimerWheel();
+	
+	void add(uvpg_timer_node *node, uint64_t expires, uint64_t now);
+	void advance(uint64_t now, uvpg_expire_cb callback, void *data);
+	bool empty() { return armed_count == 0; };
+	uint64_t tick() { return tick_ms; };
+};
+
+#endif /* defined(__UVPGTimerWheel__) */
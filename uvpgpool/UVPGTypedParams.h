@@ -0,0 +1,211 @@
+/*
+Copyright (c) 2014, Joseph Love
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+//
+//  UVPGTypedParams.h
+//  UVPGPool
+//
+
+#ifndef __UVPGTypedParams__
+#define __UVPGTypedParams__
+
+#include "UVPGParams.h"
+#include "byteorder_endian.h"
+
+#include <string.h>
+
+// UVPGParams for when the parameter types are known at compile time: the oids and formats
+// are static arrays, and the values are encoded into a buffer inside the object, sized from
+// the types.  Nothing is allocated, so it can live on the stack for the length of a
+// sendQueryAndDo() call (which copies it, should the query have to wait for a connection):
+//
+//	pool->sendQueryAndDo("SELECT name FROM users WHERE id = $1 AND status = $2",
+//		UVPGTypedParams<int32_t, const char *>(user_id, "active"), FORMAT_BINARY, data, callback);
+//
+// or UVPGPool::query<int32_t, const char *>(sql, user_id, "active", FORMAT_BINARY, data, callback).
+
+// per type: its oid, format, how much buffer it needs, and how to encode it.  encode() points
+// *out at the value (in buf, or the caller's memory) and returns its length.
+template<class T> struct uvpg_param_type;
+
+template<> struct uvpg_param_type<int16_t>
+{
+	static constexpr Oid oid = INT2OID;
+	static constexpr int format = FORMAT_BINARY;
+	static constexpr size_t size = sizeof(int16_t);
+	static int encode(char *buf, int16_t value, const char **out)
+	{
+		uint16_t be = htobe16((uint16_t)value);
+		memcpy(buf, &be, size);
+		*out = buf;
+		return (int)size;
+	}
+};
+
+template<> struct uvpg_param_type<int32_t>
+{
+	static constexpr Oid oid = INT4OID;
+	static constexpr int format = FORMAT_BINARY;
+	static constexpr size_t size = sizeof(int32_t);
+	static int encode(char *buf, int32_t value, const char **out)
+	{
+		uint32_t be = htobe32((uint32_t)value);
+		memcpy(buf, &be, size);
+		*out = buf;
+		return (int)size;
+	}
+};
+
+template<> struct uvpg_param_type<int64_t>
+{
+	static constexpr Oid oid = INT8OID;
+	static constexpr int format = FORMAT_BINARY;
+	static constexpr size_t size = sizeof(int64_t);
+	static int encode(char *buf, int64_t value, const char **out)
+	{
+		uint64_t be = htobe64((uint64_t)value);
+		memcpy(buf, &be, size);
+		*out = buf;
+		return (int)size;
+	}
+};
+
+template<> struct uvpg_param_type<float>
+{
+	static constexpr Oid oid = FLOAT4OID;
+	static constexpr int format = FORMAT_BINARY;
+	static constexpr size_t size = sizeof(float);
+	static int encode(char *buf, float value, const char **out)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		bits = htobe32(bits);
+		memcpy(buf, &bits, size);
+		*out = buf;
+		return (int)size;
+	}
+};
+
+template<> struct uvpg_param_type<double>
+{
+	static constexpr Oid oid = FLOAT8OID;
+	static constexpr int format = FORMAT_BINARY;
+	static constexpr size_t size = sizeof(double);
+	static int encode(char *buf, double value, const char **out)
+	{
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		bits = htobe64(bits);
+		memcpy(buf, &bits, size);
+		*out = buf;
+		return (int)size;
+	}
+};
+
+template<> struct uvpg_param_type<bool>
+{
+	static constexpr Oid oid = BOOLOID;
+	static constexpr int format = FORMAT_BINARY;
+	static constexpr size_t size = 1;
+	static int encode(char *buf, bool value, const char **out)
+	{
+		buf[0] = value ? 1 : 0;
+		*out = buf;
+		return (int)size;
+	}
+};
+
+// text goes as is, without a copy: the string has to outlive the UVPGTypedParams.  NULL is
+// an SQL NULL.
+template<> struct uvpg_param_type<const char *>
+{
+	static constexpr Oid oid = TEXTOID;
+	static constexpr int format = FORMAT_TEXT;
+	static constexpr size_t size = 0;
+	static int encode(char *, const char *value, const char **out)
+	{
+		*out = value;
+		return 0;
+	}
+};
+
+template<> struct uvpg_param_type<char *> : public uvpg_param_type<const char *> { };
+
+template<class... _Ts> struct uvpg_param_size;
+template<> struct uvpg_param_size<>
+{
+	static constexpr size_t value = 0;
+};
+template<class T, class... _Ts> struct uvpg_param_size<T, _Ts...>
+{
+	static constexpr size_t value = uvpg_param_type<T>::size + uvpg_param_size<_Ts...>::value;
+};
+
+template<class... _Ts>
+class UVPGTypedParams
+{
+public:
+	static constexpr int count = (int)sizeof...(_Ts);
+	// one extra slot on everything, so there's no zero sized array with no parameters.
+	static constexpr Oid oid_list[sizeof...(_Ts) + 1] = { uvpg_param_type<_Ts>::oid..., 0 };
+	static constexpr int format_list[sizeof...(_Ts) + 1] = { uvpg_param_type<_Ts>::format..., 0 };
+	
+	const char *value_list[sizeof...(_Ts) + 1];
+	int length_list[sizeof...(_Ts) + 1];
+	char buffer[uvpg_param_size<_Ts...>::value + 1];
+	
+	UVPGTypedParams(_Ts... in_values)
+	{
+		char *pos = buffer;
+		int i = 0;
+		// encodes the values in order, a braced list is evaluated left to right.
+		int expand[] = { 0, (length_list[i] = uvpg_param_type<_Ts>::encode(pos, in_values, &value_list[i]),
+							 pos += uvpg_param_type<_Ts>::size, i++)... };
+		(void)expand;
+		value_list[count] = NULL;
+		length_list[count] = 0;
+	}
+	
+	uvpg_param_arrays arrays() const
+	{
+		return uvpg_param_arrays(count, oid_list, value_list, length_list, format_list);
+	}
+	operator uvpg_param_arrays() const { return arrays(); }
+	
+	UVPGParams toParams() const
+	{
+		UVPGParams params(count);
+		params.assign(arrays());
+		return params;
+	}
+};
+
+template<class... _Ts> constexpr int UVPGTypedParams<_Ts...>::count;
+template<class... _Ts> constexpr Oid UVPGTypedParams<_Ts...>::oid_list[sizeof...(_Ts) + 1];
+template<class... _Ts> constexpr int UVPGTypedParams<_Ts...>::format_list[sizeof...(_Ts) + 1];
+
+#endif /* defined(__UVPGTypedParams__) */
@@ -44,9 +44,12 @@
 #define MACADDROID 829
 #define INETOID 869
 #define CIDROID 650
+#define INT2ARRAYOID		1005
 #define INT4ARRAYOID		1007
 #define TEXTARRAYOID		1009
+#define INT8ARRAYOID		1016
 #define FLOAT4ARRAYOID 1021
+#define FLOAT8ARRAYOID 1022
 #define ACLITEMOID		1033
 #define CSTRINGARRAYOID		1263
 #define BPCHAROID		1042